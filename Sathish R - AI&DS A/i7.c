@@ -1,387 +1,6388 @@
+// Build: gcc -O2 -pthread i7.c -o i7
+// (add -march=native to use AVX2/SSE4.2 where the CPU has them, and
+// -DI7_URING for the io_uring I/O backend on Linux)
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h> // For offsetof()
+#include <limits.h> // For LLONG_MIN/LLONG_MAX
 #include <ctype.h>  // For isprint()
+#include <pthread.h>   // For parallel scans
+#include <sched.h>     // For sched_yield()
+#include <time.h>      // For clock_gettime() in the replication status
+#include <poll.h>      // For the replication link's waits
+#include <unistd.h>    // For sysconf()
+#include <sys/file.h>  // For flock()
+#include <sys/stat.h>  // For fstat()
+#include <sys/mman.h>  // For mmap() of the checksum file
+#include <sys/resource.h> // For setpriority() of the scrub thread
+#include <sys/syscall.h>  // For SYS_gettid
+#include <fcntl.h>     // For open()
+#include <errno.h>
+#include <stdarg.h>    // For serveReply()
+#include <signal.h>    // For stopping the server
+#include <sys/epoll.h> // For the server's event loop
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#ifdef I7_URING
+#include <sys/uio.h>          // For struct iovec
+#include <linux/io_uring.h>   // io_uring ABI, driven through raw system calls
+#endif
+#ifdef __SSE2__
+#include <immintrin.h> // SSE2/SSE4.2/AVX2 intrinsics, as enabled by -m flags
+#endif
+
+// Optional hot-path tracing. Build with -DI7_TRACE to compile the spans in,
+// e.g. gcc -DI7_TRACE i7.c -o i7; without it every TRACE_SPAN expands to
+// nothing. Spans are written as Chrome trace event JSON (load the file in
+// ui.perfetto.dev) to $I7_TRACE_FILE or i7_trace.<pid>.json at exit.
+#ifdef I7_TRACE
+struct traceEvent {
+    const char *name;     // span name (string literal)
+    const char *category; // parse, lock, read, write, sort, format, journal
+    long long start;      // start timestamp in microseconds
+    long long duration;   // duration in microseconds
+    int tid;              // kernel thread id of the thread that ran the span
+};
+
+struct traceSpan {
+    const char *name;
+    const char *category;
+    long long start;
+};
+
+// Spans end on shard workers and pool threads too, so appends take traceLock
+struct traceEvent *traceEvents = NULL; // recorded spans, flushed at exit
+size_t traceCount = 0;
+size_t traceCapacity = 0;
+pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+__thread int traceTid; // cached gettid() of the calling thread (0 = not yet read)
+
+long long traceNow(void);
+struct traceSpan traceSpanBegin(const char *name, const char *category);
+void traceSpanEnd(struct traceSpan *span);
+void traceFlush(void);
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// Opens a span that closes automatically when the enclosing block exits
+#define TRACE_SPAN(name, category) \
+    struct traceSpan TRACE_CONCAT(traceSpan_, __LINE__) \
+        __attribute__((cleanup(traceSpanEnd))) = traceSpanBegin(name, category)
+#else
+#define TRACE_SPAN(name, category) do { } while (0)
+#endif
+
+struct recordStore; // credit.dat plus its record cache, defined below
 
 // Function Prototypes
-void sortOption(FILE *fPtr);
+void sortOption(struct recordStore *store);
 unsigned int enterChoice(void);
-void textFile(FILE *readPtr);
-void updateRecord(FILE *fPtr);
-void newRecord(FILE *fPtr);
-void deleteRecord(FILE *fPtr);
-void sortAccounts(FILE *fPtr, int criterion, int ascending);  // Sort function prototype
+void textFile(struct recordStore *store);
+void updateRecord(struct recordStore *store);
+void newRecord(struct recordStore *store);
+void deleteRecord(struct recordStore *store);
+int commitShard(struct recordStore *store);
+void sortAccounts(struct recordStore *store, int criterion, int ascending);  // Sort function prototype
+void showStatistics(struct recordStore *store);
+void showExtremeBalance(struct recordStore *store, int maximum);
+void aggregateOption(struct recordStore *store);
+void sortPageOption(struct recordStore *store);
+int serve(struct recordStore *store, const char *address, int replica);
+int shipJournal(struct recordStore *store, const char *address);
+int standby(struct recordStore *store, const char *address);
+int feed(struct recordStore *store, const char *address);
+long migrateCents(const char *fileName);
+long migrateVersion2(const char *fileName);
+
+#define LAST_NAME_SIZE 32  // last name bytes with the terminator
+#define FIRST_NAME_SIZE 24 // first name bytes with the terminator
+#define DEFAULT_MAX_ACCOUNT 1000000 // highest account number when I7_MAX_ACCOUNT is unset
+
+// Highest account number the menu and --serve accept. Records sit at
+// their account's slot, so an unchecked number would grow the file (or a
+// shard) to fit it.
+unsigned int maxAccount = DEFAULT_MAX_ACCOUNT;
+
+// clientData structure definition
+struct clientData {
+    unsigned int acctNum;           // account number
+    char lastName[LAST_NAME_SIZE];   // account last name
+    char firstName[FIRST_NAME_SIZE]; // account first name
+    long long balance;              // account balance in cents
+}; // end structure clientData
+
+// On-disk layout of one 40-byte record of a version 1 (headerless)
+// credit.dat. Records written before balances were fixed point keep the
+// balance as a double and leave the three bytes after the names as
+// padding; newer records put CENTS_TAG there and store int64 cents.
+// Every record describes itself, so a file can be migrated in place a
+// record at a time and old and new records can be mixed.
+struct diskRecord {
+    unsigned int acctNum;  // account number
+    char lastName[15];     // account last name
+    char firstName[10];    // account first name
+    unsigned char tag[3];  // CENTS_TAG in cents records
+    union {
+        double amount;     // balance of untagged records
+        long long cents;   // balance of tagged records
+    } balance;
+}; // end structure diskRecord
+
+#define CENTS_TAG "\xC2\xA2\x02" // "cent sign": balance is in cents
+
+// Version 2 files start with this header, followed by packedRecords.
+// Version 1 files have no header; their first four bytes are the account
+// number of slot 1 (0 or 1), which can never match FILE_MAGIC.
+struct fileHeader {
+    char magic[8];                  // FILE_MAGIC
+    unsigned int version;           // FILE_VERSION
+    unsigned int recordSize;        // bytes per record
+    unsigned long long recordCount; // record slots in the file
+    unsigned int flags;             // FILE_FLAG_* bits
+    unsigned int reserved;          // zero
+}; // end structure fileHeader
+
+#define FILE_MAGIC "I7BANK\r\n"
+#define FILE_VERSION 2
+#define FILE_FLAG_CENTS 0x1 // balances are int64 cents (always set)
+
+// One 16-byte record of a version 2 file. The names live in the name
+// heap (credit.names) as "last\0first\0" at byte offset nameRef; equal
+// full names always share one heap entry, so they have the same nameRef.
+struct packedRecord {
+    unsigned int acctNum; // account number (0 = blank slot)
+    unsigned int nameRef; // offset of the names in the name heap
+    long long balance;    // balance in cents
+}; // end structure packedRecord
+
+#define NAME_HEAP_MAGIC "I7NAMES\n" // first bytes of a name heap, so no name sits at 0
+
+// Append-only, deduplicated file of "last\0first\0" name pairs with a
+// copy in memory. An open-addressing hash table over the copy finds the
+// entry of a name pair, so each pair is stored once and interning is a
+// hash probe. Other engines may append at any time; lookups past the copy
+// reload and index the tail of the file.
+struct nameHeap {
+    FILE *filePtr;       // credit.names file pointer (NULL = version 1 file)
+    char *data;          // file contents read so far
+    size_t used;
+    size_t capacity;
+    size_t indexed;      // entries before this offset are in the table
+    unsigned int *table; // entry offsets (0 = empty slot)
+    size_t tableMask;    // table size - 1 (a power of two)
+    size_t entryCount;   // entries in the table
+}; // end structure nameHeap
+
+// One slot of the record cache
+struct cacheEntry {
+    struct clientData record; // cached copy of the record
+    unsigned int account;     // account held in this slot (0 = free)
+    int next;                 // next slot in the same hash bucket (-1 = none)
+    unsigned char referenced; // CLOCK reference bit
+    unsigned char dirty;      // changed since the last write back
+}; // end structure cacheEntry
+
+// Journal operation codes
+#define JOURNAL_NEW 1    // record created
+#define JOURNAL_UPDATE 2 // balance changed
+#define JOURNAL_DELETE 3 // record blanked
+
+// One committed record change in credit.jnl. Entries have a fixed size,
+// so the entry with log sequence number n starts at (n - 1) entries.
+// record is the record after the change; for a delete it is blank
+// (acctNum 0) but keeps the names it had, so together with oldBalance
+// every entry also gives the record before the change.
+struct journalEntry {
+    unsigned long long lsn;   // log sequence number, starting at 1
+    unsigned int op;          // JOURNAL_NEW, JOURNAL_UPDATE or JOURNAL_DELETE
+    unsigned int account;     // account the change applies to
+    long long oldBalance;     // balance before the change, in cents
+    struct clientData record; // record after the change (blank on delete)
+}; // end structure journalEntry
+
+#define CHECKPOINT_MAGIC "I7CKPT\n" // first bytes of credit.ckpt
+#define DEFAULT_CHECKPOINT_INTERVAL 1024 // entries between checkpoints when I7_CHECKPOINT is unset
+
+// Contents of credit.ckpt: every journal entry up to lsn has reached
+// credit.dat, its checksums and its name heap, and all of them are on
+// disk. Startup replays only the entries after it. The file is written
+// under a temporary name and renamed, so it is never seen half written.
+struct checkpointRecord {
+    char magic[8];                     // CHECKPOINT_MAGIC
+    unsigned long long lsn;            // last entry applied
+    unsigned long long journalOffset;  // byte offset of the next entry in credit.jnl
+    unsigned int crc;                  // CRC32C of the fields above
+    unsigned int reserved;             // zero
+}; // end structure checkpointRecord
+
+// Contents of credit.ship (written by the primary's shipper) and
+// credit.repl (written by the standby): how far the standby is behind.
+// LSNs are summed over the shards of a sharded store.
+struct replicationStatus {
+    unsigned long long primaryLsn; // entries in the primary's journal
+    unsigned long long standbyLsn; // of those, applied by the standby
+    long long updated;             // when the two last talked, ms since the epoch
+}; // end structure replicationStatus
+
+// Columnar copy of the valid accounts for balance-only scans (totals,
+// min/max, thresholds). Built once from credit.dat and then brought up to
+// date by replaying each shard's journal entries past its snapshotLsn.
+struct balanceSnapshot {
+    unsigned int *acctNum;    // account number column
+    long long *balance;       // balance column, in cents
+    unsigned int *nameOffset; // "last\0first\0" offset in names
+    char *names;              // packed sanitized names
+    int *position;            // slot -> column index (-1 = not present)
+    size_t count;             // accounts in the columns
+    size_t capacity;
+    size_t namesUsed;
+    size_t namesCapacity;
+    size_t slotCount;         // entries in position
+    int built;                // columns hold a full scan
+}; // end structure balanceSnapshot
+
+#define SCAN_BATCH 4096         // records read per fread in full scans
+#define MAX_REPAIRS 256         // accounts queued for repair at a time
+#define CHECKSUM_RETRY_US 1000  // wait before a point read checks a mismatch again
+#define VERSION_STRIPES 65536   // version counters in credit.seq (a power of two)
+#define VERSION_WRITER 1ULL     // low 32 bits: writes in progress in the stripe
+#define VERSION_DONE (1ULL << 32) // high 32 bits: writes finished in the stripe
+#define VERSION_READ_TRIES 64   // optimistic reads of a busy stripe before giving up
+
+// CRC32C of every record as it is on disk, kept in the sidecar file
+// credit.crc (4 bytes per slot) and mapped shared, so each engine sees
+// the checksums the others write. 0 means the slot has no checksum yet;
+// slots get one the first time they are written.
+struct checksumFile {
+    int fd;                 // credit.crc descriptor (-1 = none)
+    unsigned int *crc;      // mapped checksums
+    size_t slots;           // slots covered by the mapping
+    size_t stride;          // slot s holds account s * stride + shardIndex + 1
+    size_t shardIndex;
+    pthread_mutex_t lock;   // guards the mapping, queue and counters below
+    unsigned int repairQueue[MAX_REPAIRS]; // accounts found corrupt
+    size_t repairCount;
+    unsigned long long errors;   // checksum mismatches found
+    unsigned long long repairs;  // slots rewritten from the journal
+    unsigned long long scrubbed; // records checked by the scrub thread
+    pthread_t scrubThread;
+    int scrubRunning;
+    int scrubStop;               // set by closeShard, read atomically
+}; // end structure checksumFile
+
+// Point-in-time view for sequential scans. A scan reads credit.dat while
+// other engines keep committing; every account changed after the scan
+// began is kept here as it was at lsn (the before-image of its first
+// later journal entry), and records read from the file are patched from
+// it, so the scan sees the store exactly as of lsn.
+struct readView {
+    unsigned long long lsn;     // journal entry the view is as of
+    unsigned long long seen;    // later entries folded in so far
+    unsigned int *accounts;     // open-addressing table of accounts (0 = empty)
+    struct clientData *images;  // accounts[i] as of lsn
+    size_t mask;                // table size - 1 (a power of two)
+    size_t count;               // accounts in the table
+    int active;                 // a view was taken (there is a journal)
+    unsigned long long undone;  // records served from before-images
+}; // end structure readView
+
+#define MAX_SHARDS 64 // shard files a store may be split into
+
+// I/O thread of one shard. Work for the shard is posted as a job, so the
+// shards of a scan read their files in parallel.
+struct shardWorker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        // a job was posted or stop set
+    pthread_cond_t done;        // the posted job finished
+    void (*job)(struct recordStore *shard); // posted job (NULL = idle)
+    int stop;
+    int running;                // the thread was started
+}; // end structure shardWorker
+
+// One record write of a commit
+struct recordWrite {
+    unsigned int account;
+    const struct clientData *record;
+}; // end structure recordWrite
+
+// Record and journal I/O of a store: sequential scans and commits go
+// through one of these. The stdio backend makes one blocking call per
+// batch or record; the io_uring backend (built with -DI7_URING) keeps
+// the next scan batch in flight and hands a whole commit to the kernel
+// at once. Point reads, repairs and replay use pread/pwrite under both.
+struct storeBackend {
+    const char *name; // shown by the statistics
+    void (*rewind)(struct recordStore *store); // a scan is starting again at slot 0
+    size_t (*scanRead)(struct recordStore *store, size_t count); // next count records into rawBatch
+    // journal the staged entries, then write the records; 0 (with no record
+    // written) if the journal could not be written
+    int (*commit)(struct recordStore *store, const struct recordWrite *writes, size_t count);
+}; // end structure storeBackend
+
+#ifdef I7_URING
+#define RING_DEPTH 256        // submission queue entries per store
+#define RING_WRITE_BATCH 240  // records written per submission
+#define RING_TAG_PREFETCH 1   // user_data of the scan read-ahead
+#define RING_TAG_READ 2       // a scan read the caller waits for
+#define RING_TAG_JOURNAL 3    // journal append of a commit
+#define RING_TAG_SYNC 4       // journal fsync linked to the append
+#define RING_TAG_WRITE 8      // record write i of a batch is RING_TAG_WRITE + i
+
+// io_uring instance of a store, set up with the raw system calls (no
+// liburing). Two buffers are registered with the kernel: the scan
+// read-ahead and the encoded records of a commit batch.
+struct ioRing {
+    int fd;                     // ring descriptor (-1 = none)
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqArray;
+    unsigned sqMask;
+    unsigned sqEntries;
+    struct io_uring_sqe *sqes;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+    void *sqRing;               // ring mappings (one with IORING_FEAT_SINGLE_MMAP)
+    void *cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    unsigned queued;            // SQEs not yet submitted
+    unsigned inflight;          // operations other than the read-ahead not yet complete
+    int results[RING_TAG_WRITE + RING_WRITE_BATCH]; // completion result by tag
+    unsigned char *readAhead;   // registered buffer 0
+    unsigned char *writeBatch;  // registered buffer 1
+    off_t aheadOffset;          // where the read-ahead was read from (-1 = nothing usable)
+    size_t aheadLength;
+    int aheadPending;           // the read-ahead has not completed yet
+    unsigned long long submits;    // io_uring_enter calls
+    unsigned long long operations; // SQEs submitted
+}; // end structure ioRing
+#endif
+
+// The record file plus a bounded CLOCK cache of hot records. Point
+// operations go through readRecord/writeRecord; changes are journalled
+// and dirty records written back by commitRecords at the end of each
+// operation. credit.dat is either a headerless version 1 file of 40-byte
+// records or a version 2 file (header, 16-byte records, name heap).
+// A store may instead be split into shards (see openShards): then each
+// shard is a store of its own, with its own file, sidecars, journal,
+// cache and worker, holding every stride-th account, and the outer store
+// only routes point operations and merges scans.
+struct recordStore {
+    char fileName[256];         // the record file (sidecars are named after it)
+    size_t stride;              // shards of the store this one belongs to (1 = unsharded)
+    size_t shardIndex;          // this shard holds accounts shardIndex + 1, + stride, ...
+    struct recordStore *shards; // the shards (the store itself when unsharded)
+    size_t shardCount;
+    struct shardWorker worker;  // I/O thread of a shard
+    struct clientData *shardBatch; // a shard's part of the current scan batch
+    size_t shardWant;           // records it is asked for
+    size_t shardGot;            // records it read
+    unsigned long long snapshotLsn; // last journal entry applied to the outer snapshot
+    const struct storeBackend *io; // scan and commit I/O
+#ifdef I7_URING
+    struct ioRing ring;         // used by the io_uring backend
+#endif
+    struct recordWrite *writes; // records of the commit in progress
+    size_t writeCapacity;
+    FILE *filePtr;              // credit.dat file pointer
+    unsigned int version;       // file format version (1 or 2)
+    size_t recordSize;          // bytes per record on disk
+    long dataOffset;            // where slot 0 starts (after any header)
+    struct fileHeader header;   // version 2 file header
+    struct nameHeap names;      // version 2 names
+    unsigned char *rawBatch;    // on-disk records of the current batch
+    unsigned int *batchAcct;    // account column of the current batch
+    long long *batchBalance;    // balance column of the current batch
+    unsigned long long batchValid[SCAN_BATCH / 64]; // bit i: batch record i is valid
+    size_t scanSlot;            // slot of the next record a scan reads
+    struct checksumFile checksums; // per-record CRC32C and scrub state
+    int versionFd;              // credit.seq descriptor (-1 = none)
+    unsigned long long *versions; // mapped stripe versions (see versionBegin)
+    unsigned long long readRetries; // point reads repeated because a write overlapped
+    FILE *journalPtr;           // credit.jnl file pointer (NULL = none)
+    struct journalEntry *pending; // changes staged for the next commit
+    size_t pendingCount;
+    size_t pendingCapacity;
+    unsigned long long journalLsn; // last journal entry seen
+    struct readView view;       // snapshot of the current scan
+    unsigned long long checkpointLsn; // last entry known to be checkpointed
+    unsigned long long checkpointInterval; // entries between checkpoints (0 = only at startup)
+    unsigned long long checkpoints; // checkpoints this engine wrote
+    unsigned long long replayed;    // records rewritten by journal replay
+    int durable;                    // fdatasync the journal at every commit
+    int groupLocked;                // journal lock held for a serve group (see serveLock)
+    unsigned long long commits;     // commits that appended journal entries
+    unsigned long long committed;   // journal entries they appended
+    struct balanceSnapshot snapshot; // columnar copy for analytics
+    struct cacheEntry *entries; // cache slots
+    int *buckets;               // hash bucket heads (-1 = empty)
+    int *dirtyList;             // slots waiting for write back
+    size_t cacheSize;           // number of cache slots (0 = no cache)
+    size_t bucketMask;          // bucket count - 1 (a power of two)
+    size_t dirtyCount;
+    size_t clockHand;           // next slot the CLOCK sweep examines
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    unsigned long long writeBacks;
+    unsigned long long forcedCommits; // commits forced by a cache with every slot dirty
+}; // end structure recordStore
+
+#define DEFAULT_CACHE_SIZE 4096 // records cached when I7_CACHE_SIZE is unset
+#define PARALLEL_SCAN_MIN 262144 // accounts before scans are split over threads
+#define MAX_SCAN_THREADS 16
+#define AGGREGATE_CHUNKS 64     // pieces a parallel aggregate scan is cut into
+#define MAX_BUCKETS 100         // histogram buckets per aggregate query
+
+// Filters of one aggregate query
+struct aggregateQuery {
+    long long minBalance;        // lowest balance included, in cents
+    long long maxBalance;        // highest balance included, in cents
+    char prefix[LAST_NAME_SIZE]; // last name prefix ("" = any name)
+    size_t prefixLength;
+}; // end structure aggregateQuery
+
+// One chunk of an aggregate scan and its partial results
+struct aggregateChunk {
+    const struct balanceSnapshot *snap;
+    const struct aggregateQuery *query;
+    size_t begin;    // first column index scanned
+    size_t end;      // one past the last column index
+    long long *matched; // matching balances are copied to matched[begin...]
+    size_t count;       // matching accounts
+    long long sum;
+    long long min;
+    long long max;
+}; // end structure aggregateChunk
+
+#define EXPORT_LINE 96    // bytes reserved for one accounts.txt line
+#define EXPORT_GRAIN 512  // records one export task formats
+
+// One batch of an export and its formatted lines
+struct exportBatch {
+    const struct clientData *batch;
+    char *text;    // line i at text + i * EXPORT_LINE
+    int *lengths;  // bytes of line i (0 = blank slot)
+}; // end structure exportBatch
+
+#define REPLAY_BATCH 65536 // journal entries read per replay batch
+#define REPLAY_GRAIN 1024  // accounts one replay task rewrites
+
+// A replay batch, handed to the task pool in account ranges
+struct replayChunk {
+    struct recordStore *store;
+    const struct journalEntry *entries; // newest entry of each account, by account
+    const unsigned char *raw;           // their on-disk records, recordSize apart
+    unsigned long long written; // records that needed rewriting
+}; // end structure replayChunk
+
+#define TASK_DEQUE_SIZE 64 // ranges one worker may have queued
+
+// A range of bulk work: run(context, begin, end) handles items
+// [begin, end). Ranges larger than grain are split in half before they
+// run, and the halves are queued where idle workers can steal them.
+struct taskRange {
+    void (*run)(void *context, size_t begin, size_t end);
+    void *context;
+    size_t begin;
+    size_t end;
+    size_t grain;         // largest range run without splitting
+    size_t *remaining;    // items of the submitting taskRun not yet run
+}; // end structure taskRange
+
+// Ranges queued by one worker. The owner pushes and pops at the bottom,
+// so it keeps working on the range it just split; thieves take from the
+// top, where the oldest and largest halves are.
+struct taskDeque {
+    pthread_mutex_t lock;
+    struct taskRange ranges[TASK_DEQUE_SIZE]; // ring, indexed modulo the size
+    size_t top;
+    size_t bottom;
+}; // end structure taskDeque
+
+// Work-stealing pool shared by every bulk operation (replay, sorting,
+// aggregates, export). It is started on first use with one thread per
+// core, up to MAX_SCAN_THREADS or $I7_THREADS. deques[0] belongs to the
+// threads that submit work, which run ranges too while they wait.
+struct taskPool {
+    pthread_t threads[MAX_SCAN_THREADS];
+    struct taskDeque deques[MAX_SCAN_THREADS];
+    int workers;        // deques in use: pool threads + 1
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // a range was queued or stop set
+    size_t queued;      // ranges in all deques (raised under lock)
+    int stop;
+    unsigned long long ranges; // ranges run
+    unsigned long long splits; // ranges split in two
+    unsigned long long steals; // ranges taken from another worker
+}; // end structure taskPool
+
+int cacheFind(struct recordStore *store, unsigned int account);
+void viewBegin(struct recordStore *store);
+void viewCatchUp(struct recordStore *store);
+int viewPatch(struct recordStore *store, unsigned int account, struct clientData *client);
+void sanitizeString(char *str, int maxLength);
+void exportRange(void *context, size_t begin, size_t end);
+void validateBlock(const unsigned int *acctNum, const long long *balance, size_t firstSlot, size_t count,
+                   unsigned long long *bits);
+
+#ifdef I7_TRACE
+// Current monotonic time in microseconds
+long long traceNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+struct traceSpan traceSpanBegin(const char *name, const char *category) {
+    struct traceSpan span = {name, category, traceNow()};
+    return span;
+}
+
+// Record a finished span; the buffer grows geometrically so this stays cheap
+void traceSpanEnd(struct traceSpan *span) {
+    long long end = traceNow();
+
+    if (traceTid == 0) {
+        traceTid = (int)syscall(SYS_gettid);
+    }
+
+    pthread_mutex_lock(&traceLock);
+    if (traceCount == traceCapacity) {
+        size_t newCapacity = traceCapacity ? traceCapacity * 2 : 1024;
+        struct traceEvent *grown = realloc(traceEvents, newCapacity * sizeof(struct traceEvent));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&traceLock);
+            return; // drop the span rather than disturb the request
+        }
+        if (traceEvents == NULL) {
+            atexit(traceFlush);
+        }
+        traceEvents = grown;
+        traceCapacity = newCapacity;
+    }
+
+    traceEvents[traceCount].name = span->name;
+    traceEvents[traceCount].category = span->category;
+    traceEvents[traceCount].start = span->start;
+    traceEvents[traceCount].duration = end - span->start;
+    traceEvents[traceCount].tid = traceTid;
+    traceCount++;
+    pthread_mutex_unlock(&traceLock);
+}
+
+// Write all recorded spans as Chrome trace "complete" (ph X) events
+void traceFlush(void) {
+    char defaultName[64];
+    const char *fileName = getenv("I7_TRACE_FILE");
+    FILE *tracePtr;
+    size_t i;
+
+    if (fileName == NULL || fileName[0] == '\0') {
+        snprintf(defaultName, sizeof(defaultName), "i7_trace.%d.json", (int)getpid());
+        fileName = defaultName;
+    }
+
+    pthread_mutex_lock(&traceLock);
+    if ((tracePtr = fopen(fileName, "w")) == NULL) {
+        pthread_mutex_unlock(&traceLock);
+        return;
+    }
+
+    fprintf(tracePtr, "{\"traceEvents\":[\n");
+    for (i = 0; i < traceCount; i++) {
+        fprintf(tracePtr,
+                "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d}%s\n",
+                traceEvents[i].name, traceEvents[i].category, traceEvents[i].start,
+                traceEvents[i].duration, (int)getpid(), traceEvents[i].tid,
+                i + 1 < traceCount ? "," : "");
+    }
+    fprintf(tracePtr, "],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(tracePtr);
+
+    free(traceEvents);
+    traceEvents = NULL;
+    traceCount = traceCapacity = 0;
+    pthread_mutex_unlock(&traceLock);
+}
+#endif
+
+struct taskPool taskPool = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER};
+pthread_once_t taskPoolOnce = PTHREAD_ONCE_INIT;
+__thread int taskWorker; // deque of the calling thread (0 = a submitter)
+
+// queue range on worker self's deque; returns 0 if the deque is full
+int taskPush(int self, const struct taskRange *range) {
+    struct taskDeque *deque = &taskPool.deques[self];
+    int pushed = 0;
+
+    pthread_mutex_lock(&taskPool.lock);
+    __atomic_add_fetch(&taskPool.queued, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&taskPool.wake);
+    pthread_mutex_unlock(&taskPool.lock);
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top < TASK_DEQUE_SIZE) {
+        deque->ranges[deque->bottom++ % TASK_DEQUE_SIZE] = *range;
+        pushed = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    if (!pushed) {
+        __atomic_sub_fetch(&taskPool.queued, 1, __ATOMIC_RELAXED);
+    }
+    return pushed;
+}
+
+// take a range: the newest of self's own deque, else the oldest of
+// another worker's; returns 0 if every deque is empty
+int taskFind(int self, struct taskRange *range) {
+    int i;
+
+    for (i = 0; i < taskPool.workers; i++) {
+        int victim = (self + i) % taskPool.workers;
+        struct taskDeque *deque = &taskPool.deques[victim];
+        int found = 0;
+
+        pthread_mutex_lock(&deque->lock);
+        if (deque->bottom != deque->top) {
+            *range = i == 0 ? deque->ranges[--deque->bottom % TASK_DEQUE_SIZE]
+                            : deque->ranges[deque->top++ % TASK_DEQUE_SIZE];
+            found = 1;
+        }
+        pthread_mutex_unlock(&deque->lock);
+        if (found) {
+            __atomic_sub_fetch(&taskPool.queued, 1, __ATOMIC_RELAXED);
+            if (i != 0) {
+                __atomic_add_fetch(&taskPool.steals, 1, __ATOMIC_RELAXED);
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// split range down to its grain, queueing the upper halves, then run
+// what is left and count it done
+void taskExecute(int self, struct taskRange range) {
+    size_t done;
+
+    while (range.end - range.begin > range.grain) {
+        struct taskRange upper = range;
+
+        upper.begin = range.begin + (range.end - range.begin) / 2;
+        if (!taskPush(self, &upper)) {
+            break; // deque full: run the rest whole
+        }
+        range.end = upper.begin;
+        __atomic_add_fetch(&taskPool.splits, 1, __ATOMIC_RELAXED);
+    }
+    done = range.end - range.begin;
+    range.run(range.context, range.begin, range.end);
+    __atomic_add_fetch(&taskPool.ranges, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(range.remaining, done, __ATOMIC_RELEASE);
+}
+
+// pool thread: run queued ranges, sleep while there are none
+void *taskWorkerThread(void *context) {
+    struct taskRange range;
+
+    taskWorker = (int)(long)context;
+    pthread_mutex_lock(&taskPool.lock);
+    while (!taskPool.stop) {
+        if (__atomic_load_n(&taskPool.queued, __ATOMIC_RELAXED) == 0) {
+            pthread_cond_wait(&taskPool.wake, &taskPool.lock);
+            continue;
+        }
+        pthread_mutex_unlock(&taskPool.lock);
+        while (taskFind(taskWorker, &range)) {
+            taskExecute(taskWorker, range);
+        }
+        pthread_mutex_lock(&taskPool.lock);
+    }
+    pthread_mutex_unlock(&taskPool.lock);
+    return NULL;
+}
+
+// start the pool threads (once); fewer start if pthread_create fails
+void taskPoolStart(void) {
+    const char *threadsText = getenv("I7_THREADS");
+    long online = threadsText != NULL ? strtol(threadsText, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    int want = online < 1 ? 1 : online > MAX_SCAN_THREADS ? MAX_SCAN_THREADS : (int)online;
+    int i;
+
+    for (i = 0; i < want; i++) {
+        pthread_mutex_init(&taskPool.deques[i].lock, NULL);
+    }
+    taskPool.workers = 1;
+    for (i = 1; i < want; i++) {
+        if (pthread_create(&taskPool.threads[i], NULL, taskWorkerThread, (void *)(long)i) != 0) {
+            break;
+        }
+        taskPool.workers++;
+    }
+}
+
+// number of threads bulk work is spread over (starts the pool)
+int taskWorkers(void) {
+    pthread_once(&taskPoolOnce, taskPoolStart);
+    return taskPool.workers;
+}
+
+// Run run(context, b, e) over all of [begin, end) in ranges of at most
+// grain items (more only if a deque fills up), on every pool thread and
+// the caller, and return when all of it has run. Ranges may run in any
+// order and at the same time, so run must only touch its own items.
+void taskRun(void (*run)(void *context, size_t begin, size_t end), void *context,
+             size_t begin, size_t end, size_t grain) {
+    size_t remaining = end - begin;
+    struct taskRange range = {run, context, begin, end, grain ? grain : 1, &remaining};
+    struct taskRange other;
+
+    if (remaining <= range.grain || taskWorkers() < 2) {
+        run(context, begin, end);
+        return;
+    }
+    taskExecute(taskWorker, range);
+    while (__atomic_load_n(&remaining, __ATOMIC_ACQUIRE) != 0) {
+        if (taskFind(taskWorker, &other)) {
+            taskExecute(taskWorker, other);
+        } else {
+            sched_yield(); // the last ranges are running elsewhere
+        }
+    }
+}
+
+// stop and join the pool threads
+void taskPoolStop(void) {
+    int i;
+
+    pthread_mutex_lock(&taskPool.lock);
+    taskPool.stop = 1;
+    pthread_cond_broadcast(&taskPool.wake);
+    pthread_mutex_unlock(&taskPool.lock);
+    for (i = 1; i < taskPool.workers; i++) {
+        pthread_join(taskPool.threads[i], NULL);
+    }
+    taskPool.workers = 0;
+}
+
+// round a version 1 double balance to cents; returns 0 if the double is
+// not finite or too large for cents in 64 bits
+int centsFromAmount(double amount, long long *cents) {
+    double scaled = amount * 100.0 + (amount < 0 ? -0.5 : 0.5);
+
+    if (!(scaled > -9.2e18 && scaled < 9.2e18)) {
+        return 0; // NaN, infinite or out of range
+    }
+    *cents = (long long)scaled;
+    return 1;
+}
+
+// read I7_MAX_ACCOUNT into maxAccount (values that are not a positive
+// 32-bit number keep the default)
+void loadAccountLimit(void) {
+    const char *limitText = getenv("I7_MAX_ACCOUNT");
+    unsigned long long limit = limitText != NULL ? strtoull(limitText, NULL, 10) : 0;
+
+    if (limit > 0 && limit <= UINT_MAX) {
+        maxAccount = (unsigned int)limit;
+    }
+}
+
+// 1 if account is a number the store accepts
+int accountInRange(unsigned int account) {
+    return account >= 1 && account <= maxAccount;
+}
+
+// write cents as "-1234.56" into text (at least 24 bytes) and return it
+char *formatCents(long long cents, char *text) {
+    unsigned long long magnitude = cents < 0 ? 0ULL - (unsigned long long)cents : (unsigned long long)cents;
+
+    sprintf(text, "%s%llu.%02llu", cents < 0 ? "-" : "", magnitude / 100, magnitude % 100);
+    return text;
+}
+
+// parse "[+-]units[.fraction]" into cents, rounding half away from zero
+// past the second decimal; returns 0 if text is not an amount
+int parseCents(const char *text, long long *cents) {
+    unsigned long long units = 0;
+    int negative = 0, fraction = 0, digits = 0, roundUp = 0;
+
+    if (*text == '-' || *text == '+') {
+        negative = *text++ == '-';
+    }
+    if (!isdigit((unsigned char)*text) && !(*text == '.' && isdigit((unsigned char)text[1]))) {
+        return 0;
+    }
+    for (; isdigit((unsigned char)*text); text++) {
+        units = units * 10 + (*text - '0');
+        if (units > (LLONG_MAX - 99) / 100) {
+            return 0; // too large for cents in 64 bits
+        }
+    }
+    if (*text == '.') {
+        for (text++; isdigit((unsigned char)*text); text++, digits++) {
+            if (digits < 2) {
+                fraction = fraction * 10 + (*text - '0');
+            } else if (digits == 2) {
+                roundUp = *text >= '5';
+            }
+        }
+    }
+    if (*text != '\0') {
+        return 0;
+    }
+    if (digits == 1) {
+        fraction *= 10;
+    }
+
+    *cents = (long long)(units * 100 + fraction + roundUp);
+    if (negative) {
+        *cents = -*cents;
+    }
+    return 1;
+}
+
+// convert a record of either on-disk version to the in-memory form
+void decodeRecord(const struct diskRecord *disk, struct clientData *client) {
+    client->acctNum = disk->acctNum;
+    memcpy(client->lastName, disk->lastName, sizeof(disk->lastName));
+    memcpy(client->firstName, disk->firstName, sizeof(disk->firstName));
+    client->lastName[sizeof(disk->lastName) - 1] = '\0';
+    client->firstName[sizeof(disk->firstName) - 1] = '\0';
+    if (memcmp(disk->tag, CENTS_TAG, sizeof(disk->tag)) == 0) {
+        client->balance = disk->balance.cents;
+    } else if (!centsFromAmount(disk->balance.amount, &client->balance)) {
+        client->balance = LLONG_MIN; // not an amount: outside every valid range
+    }
+}
+
+// convert an in-memory record to the tagged version 1 form; names that do
+// not fit the fixed fields are cut short
+void encodeRecord(const struct clientData *client, struct diskRecord *disk) {
+    memset(disk, 0, sizeof(*disk));
+    if (client->acctNum == 0) {
+        return; // blank slot
+    }
+    disk->acctNum = client->acctNum;
+    memcpy(disk->lastName, client->lastName, strnlen(client->lastName, sizeof(disk->lastName) - 1));
+    memcpy(disk->firstName, client->firstName, strnlen(client->firstName, sizeof(disk->firstName) - 1));
+    memcpy(disk->tag, CENTS_TAG, sizeof(disk->tag));
+    disk->balance.cents = client->balance;
+}
+
+#if !(defined(__SSE4_2__) && defined(__x86_64__))
+unsigned int crc32cTable[256]; // CRC32C (Castagnoli) byte table
+pthread_once_t crc32cTableOnce = PTHREAD_ONCE_INIT;
+
+void crc32cBuildTable(void) {
+    unsigned int i, bit, crc;
+
+    for (i = 0; i < 256; i++) {
+        for (crc = i, bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0x82F63B78u & (0U - (crc & 1)));
+        }
+        crc32cTable[i] = crc;
+    }
+}
+#endif
+
+// CRC32C of length bytes: the SSE4.2 crc32 instruction eight bytes at a
+// time when the build allows it, a byte table otherwise
+unsigned int crc32c(const void *data, size_t length) {
+    const unsigned char *bytes = data;
+    unsigned int crc = 0xFFFFFFFFu;
+
+#if defined(__SSE4_2__) && defined(__x86_64__)
+    for (; length >= 8; length -= 8, bytes += 8) {
+        unsigned long long word;
+        memcpy(&word, bytes, sizeof(word));
+        crc = (unsigned int)_mm_crc32_u64(crc, word);
+    }
+    for (; length > 0; length--) {
+        crc = _mm_crc32_u8(crc, *bytes++);
+    }
+#else
+    pthread_once(&crc32cTableOnce, crc32cBuildTable);
+    for (; length > 0; length--) {
+        crc = (crc >> 8) ^ crc32cTable[(crc ^ *bytes++) & 0xFF];
+    }
+#endif
+    return ~crc;
+}
+
+// the version 2 header of fPtr, if it has one; returns 0 for version 1
+int readFileHeader(FILE *fPtr, struct fileHeader *header) {
+    rewind(fPtr);
+    if (fread(header, sizeof(struct fileHeader), 1, fPtr) != 1 ||
+        memcmp(header->magic, FILE_MAGIC, sizeof(header->magic)) != 0) {
+        memset(header, 0, sizeof(*header));
+        return 0;
+    }
+    return 1;
+}
+
+// file next to the record file fileName with the given suffix in place
+// of ".dat" (credit.dat -> credit.names, credit.crc)
+void sidecarFileName(const char *fileName, const char *suffix, char *path, size_t size) {
+    size_t length = strlen(fileName);
+
+    if (length > 4 && strcmp(fileName + length - 4, ".dat") == 0) {
+        length -= 4;
+    }
+    snprintf(path, size, "%.*s%s", (int)length, fileName, suffix);
+}
+
+// file of shard index of the store fileName (credit.dat -> credit.s3.dat)
+void shardFileName(const char *fileName, size_t index, char *path, size_t size) {
+    char suffix[32];
+
+    snprintf(suffix, sizeof(suffix), ".s%zu.dat", index);
+    sidecarFileName(fileName, suffix, path, size);
+}
+
+// the shard holding account. Accounts go round-robin (the account number
+// modulo the shard count), which spreads them evenly as they are handed
+// out in order.
+struct recordStore *shardOf(struct recordStore *store, unsigned int account) {
+    return &store->shards[(account - 1) % store->shardCount];
+}
+
+// slot of account in its shard's file
+size_t localSlot(const struct recordStore *store, unsigned int account) {
+    return (account - 1) / store->stride;
+}
+
+// account held in slot of a shard's file
+unsigned int slotAccount(const struct recordStore *store, size_t slot) {
+    return (unsigned int)(slot * store->stride + store->shardIndex) + 1;
+}
+
+// make the checksum mapping cover slot, growing credit.crc if grow is set;
+// returns 0 if slot has no checksum. Called with the checksum lock held.
+int checksumCover(struct checksumFile *sums, size_t slot, int grow) {
+    struct stat info;
+    size_t slots;
+    void *mapped;
+
+    if (slot < sums->slots) {
+        return 1;
+    }
+    if (sums->fd < 0 || fstat(sums->fd, &info) != 0) {
+        return 0;
+    }
+    if ((size_t)info.st_size / sizeof(unsigned int) <= slot) {
+        if (!grow) {
+            return 0;
+        }
+        // grow in 64K-slot steps, never shrinking what another engine grew
+        flock(sums->fd, LOCK_EX);
+        if (fstat(sums->fd, &info) == 0 && (size_t)info.st_size / sizeof(unsigned int) <= slot) {
+            ftruncate(sums->fd, (off_t)((slot / 65536 + 1) * 65536 * sizeof(unsigned int)));
+            fstat(sums->fd, &info);
+        }
+        flock(sums->fd, LOCK_UN);
+    }
+    slots = (size_t)info.st_size / sizeof(unsigned int);
+    if (slots <= slot) {
+        return 0;
+    }
+    mapped = mmap(NULL, slots * sizeof(unsigned int), PROT_READ | PROT_WRITE, MAP_SHARED, sums->fd, 0);
+    if (mapped == MAP_FAILED) {
+        return 0;
+    }
+    if (sums->crc != NULL) {
+        munmap(sums->crc, sums->slots * sizeof(unsigned int));
+    }
+    sums->crc = mapped;
+    sums->slots = slots;
+    return 1;
+}
+
+// note that slot failed its checksum and queue its account for repair.
+// Called with the checksum lock held.
+void checksumFailed(struct checksumFile *sums, size_t slot) {
+    unsigned int account = (unsigned int)(slot * sums->stride + sums->shardIndex) + 1;
+    size_t i;
+
+    sums->errors++;
+    fprintf(stderr, "i7: record %u failed its checksum\n", account);
+    for (i = 0; i < sums->repairCount; i++) {
+        if (sums->repairQueue[i] == account) {
+            return;
+        }
+    }
+    if (sums->repairCount < MAX_REPAIRS) {
+        sums->repairQueue[sums->repairCount++] = account;
+    }
+}
+
+// check the on-disk bytes of slot against its checksum; 1 if they match
+// or the slot has none. A mismatch is reported only if report is set.
+int checksumVerify(struct checksumFile *sums, size_t slot, const void *raw, size_t recordSize, int report) {
+    unsigned int stored;
+    int ok = 1;
+
+    pthread_mutex_lock(&sums->lock);
+    if (checksumCover(sums, slot, 0) && (stored = sums->crc[slot]) != 0 && stored != crc32c(raw, recordSize)) {
+        if (report) {
+            checksumFailed(sums, slot);
+        }
+        ok = 0;
+    }
+    pthread_mutex_unlock(&sums->lock);
+    return ok;
+}
+
+// record the checksum of the bytes just written to slot
+void checksumUpdate(struct checksumFile *sums, size_t slot, const void *raw, size_t recordSize) {
+    unsigned int crc = crc32c(raw, recordSize);
+
+    pthread_mutex_lock(&sums->lock);
+    if (checksumCover(sums, slot, 1)) {
+        sums->crc[slot] = crc;
+    }
+    pthread_mutex_unlock(&sums->lock);
+}
+
+// Record versions. credit.seq holds VERSION_STRIPES 64-bit counters,
+// mapped shared by every engine; slot s belongs to stripe s modulo the
+// count. A writer adds VERSION_WRITER before it writes a record and its
+// checksum, and turns that into VERSION_DONE once both are written, so
+// a stripe's counter changes across every write and shows any write
+// still in progress. Point reads take no lock: they read the record
+// between two looks at its stripe and go again if the counter moved
+// (see readSlot). Counting writers rather than flipping one bit lets
+// several writes share a stripe at once: a commit batch, parallel
+// replay ranges, or another engine's eviction write-back.
+void versionOpen(struct recordStore *store, const char *fileName) {
+    char path[512];
+    struct stat info;
+    void *mapped;
+
+    store->versions = NULL;
+    sidecarFileName(fileName, ".seq", path, sizeof(path));
+    if ((store->versionFd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+        return;
+    }
+    flock(store->versionFd, LOCK_EX);
+    if (fstat(store->versionFd, &info) == 0 &&
+        (size_t)info.st_size < VERSION_STRIPES * sizeof(unsigned long long)) {
+        ftruncate(store->versionFd, (off_t)(VERSION_STRIPES * sizeof(unsigned long long)));
+    }
+    flock(store->versionFd, LOCK_UN);
+    mapped = mmap(NULL, VERSION_STRIPES * sizeof(unsigned long long), PROT_READ | PROT_WRITE, MAP_SHARED,
+                  store->versionFd, 0);
+    if (mapped == MAP_FAILED) {
+        close(store->versionFd);
+        store->versionFd = -1;
+        return;
+    }
+    store->versions = mapped;
+}
+
+// a write of slot is starting
+void versionBegin(struct recordStore *store, size_t slot) {
+    if (store->versions != NULL) {
+        __atomic_add_fetch(&store->versions[slot & (VERSION_STRIPES - 1)], VERSION_WRITER, __ATOMIC_SEQ_CST);
+    }
+}
+
+// the write of slot begun by versionBegin is on disk, checksum included
+void versionEnd(struct recordStore *store, size_t slot) {
+    if (store->versions != NULL) {
+        __atomic_add_fetch(&store->versions[slot & (VERSION_STRIPES - 1)], VERSION_DONE - VERSION_WRITER,
+                           __ATOMIC_SEQ_CST);
+    }
+}
+
+// Read the bytes of slot into raw through fd, retrying while a write of
+// its stripe overlaps the read. Returns 1 if the bytes and the checksum
+// map are known to be from one finished write, 0 if that could not be
+// shown (no credit.seq, or a writer stayed in the stripe, e.g. because
+// it died mid-write) and -1 if the slot could not be read.
+int readSlot(struct recordStore *store, int fd, size_t slot, unsigned char *raw) {
+    off_t offset = store->dataOffset + (off_t)(slot * store->recordSize);
+    int tries;
+
+    for (tries = 0;; tries++) {
+        unsigned long long before = 0;
+
+        if (store->versions != NULL) {
+            before = __atomic_load_n(&store->versions[slot & (VERSION_STRIPES - 1)], __ATOMIC_ACQUIRE);
+        }
+        if (pread(fd, raw, store->recordSize, offset) != (ssize_t)store->recordSize) {
+            return -1;
+        }
+        if (store->versions == NULL) {
+            return 0;
+        }
+        if ((before & (VERSION_DONE - 1)) == 0 &&
+            __atomic_load_n(&store->versions[slot & (VERSION_STRIPES - 1)], __ATOMIC_ACQUIRE) == before) {
+            return 1;
+        }
+        if (tries + 1 == VERSION_READ_TRIES) {
+            return 0;
+        }
+        __atomic_add_fetch(&store->readRetries, 1, __ATOMIC_RELAXED);
+        sched_yield();
+    }
+}
+
+// FNV-1a hash of the name pair stored at names
+unsigned int nameHash(const char *names, size_t length) {
+    unsigned int hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)names[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// length of the "last\0first\0" pair at offset, or 0 if it is incomplete
+size_t nameEntryLength(const struct nameHeap *heap, size_t offset) {
+    const char *end = heap->data + heap->used;
+    const char *lastEnd = memchr(heap->data + offset, '\0', end - (heap->data + offset));
+    const char *firstEnd = lastEnd ? memchr(lastEnd + 1, '\0', end - (lastEnd + 1)) : NULL;
+
+    return firstEnd ? (size_t)(firstEnd + 1 - (heap->data + offset)) : 0;
+}
+
+// add the entry at offset to the hash table, doubling it when half full
+void nameHeapIndex(struct nameHeap *heap, size_t offset, size_t length) {
+    size_t slot;
+
+    if (2 * (heap->entryCount + 1) > heap->tableMask + 1) {
+        size_t newSize = heap->table ? 2 * (heap->tableMask + 1) : 1024, i;
+        unsigned int *grown = calloc(newSize, sizeof(unsigned int));
+        if (grown == NULL) {
+            return; // still found by value later, just not deduplicated
+        }
+        for (i = 0; heap->table != NULL && i <= heap->tableMask; i++) {
+            if (heap->table[i] != 0) {
+                size_t ref = heap->table[i];
+                slot = nameHash(heap->data + ref, nameEntryLength(heap, ref)) & (newSize - 1);
+                while (grown[slot] != 0) {
+                    slot = (slot + 1) & (newSize - 1);
+                }
+                grown[slot] = (unsigned int)ref;
+            }
+        }
+        free(heap->table);
+        heap->table = grown;
+        heap->tableMask = newSize - 1;
+    }
+    slot = nameHash(heap->data + offset, length) & heap->tableMask;
+    while (heap->table[slot] != 0) {
+        slot = (slot + 1) & heap->tableMask;
+    }
+    heap->table[slot] = (unsigned int)offset;
+    heap->entryCount++;
+}
+
+// read whatever other engines appended to the heap since the last load
+// and index the new entries
+void nameHeapLoad(struct nameHeap *heap) {
+    struct stat info;
+    size_t size, length;
+
+    if (fstat(fileno(heap->filePtr), &info) != 0 || (size_t)info.st_size <= heap->used) {
+        return;
+    }
+    size = (size_t)info.st_size;
+    if (size > heap->capacity) {
+        size_t newCapacity = heap->capacity ? heap->capacity : 4096;
+        char *grown;
+        while (newCapacity < size) {
+            newCapacity *= 2;
+        }
+        if ((grown = realloc(heap->data, newCapacity)) == NULL) {
+            return;
+        }
+        heap->data = grown;
+        heap->capacity = newCapacity;
+    }
+    fseek(heap->filePtr, (long)heap->used, SEEK_SET);
+    heap->used += fread(heap->data + heap->used, 1, size - heap->used, heap->filePtr);
+
+    if (heap->indexed == 0) {
+        heap->indexed = sizeof(NAME_HEAP_MAGIC) - 1;
+    }
+    while (heap->indexed < heap->used && (length = nameEntryLength(heap, heap->indexed)) > 0) {
+        nameHeapIndex(heap, heap->indexed, length);
+        heap->indexed += length;
+    }
+}
+
+// offset of the entry holding names (a "last\0first\0" pair), or 0
+unsigned int nameHeapFind(const struct nameHeap *heap, const char *names, size_t length) {
+    size_t slot;
+
+    if (heap->table == NULL) {
+        return 0;
+    }
+    slot = nameHash(names, length) & heap->tableMask;
+    for (; heap->table[slot] != 0; slot = (slot + 1) & heap->tableMask) {
+        unsigned int ref = heap->table[slot];
+        if (ref + length <= heap->used && memcmp(heap->data + ref, names, length) == 0) {
+            return ref;
+        }
+    }
+    return 0;
+}
+
+// copy the names at ref into client; returns 0 if ref is not a name
+int nameHeapGet(struct nameHeap *heap, unsigned int ref, struct clientData *client) {
+    const char *lastName, *firstName, *end;
+
+    if (ref >= heap->used || memchr(heap->data + ref, '\0', heap->used - ref) == NULL) {
+        nameHeapLoad(heap); // appended by another engine
+    }
+    if (ref < sizeof(NAME_HEAP_MAGIC) - 1 || ref >= heap->used) {
+        return 0;
+    }
+    lastName = heap->data + ref;
+    end = heap->data + heap->used;
+    if ((firstName = memchr(lastName, '\0', end - lastName)) == NULL ||
+        memchr(firstName + 1, '\0', end - firstName - 1) == NULL) {
+        return 0;
+    }
+    firstName++;
+    snprintf(client->lastName, sizeof(client->lastName), "%s", lastName);
+    snprintf(client->firstName, sizeof(client->firstName), "%s", firstName);
+    return 1;
+}
+
+// offset of the heap entry for the names of client, appending one if no
+// engine has stored this name pair yet; 0 if the heap cannot take it
+unsigned int nameHeapIntern(struct nameHeap *heap, const struct clientData *client) {
+    char names[LAST_NAME_SIZE + FIRST_NAME_SIZE];
+    size_t lastLength = strnlen(client->lastName, sizeof(client->lastName) - 1);
+    size_t firstLength = strnlen(client->firstName, sizeof(client->firstName) - 1);
+    size_t length = lastLength + firstLength + 2;
+    struct stat info;
+    unsigned int ref;
+
+    memcpy(names, client->lastName, lastLength);
+    names[lastLength] = '\0';
+    memcpy(names + lastLength + 1, client->firstName, firstLength);
+    names[lastLength + 1 + firstLength] = '\0';
+
+    if ((ref = nameHeapFind(heap, names, length)) != 0) {
+        return ref;
+    }
+
+    // the lock keeps appends from concurrent engines whole and in order;
+    // look again under it in case another engine just added the pair
+    flock(fileno(heap->filePtr), LOCK_EX);
+    nameHeapLoad(heap);
+    if ((ref = nameHeapFind(heap, names, length)) == 0 &&
+        fstat(fileno(heap->filePtr), &info) == 0 && info.st_size < 0xFFFFFF00) {
+        fseek(heap->filePtr, 0, SEEK_END);
+        if (fwrite(names, 1, length, heap->filePtr) == length && fflush(heap->filePtr) == 0) {
+            ref = (unsigned int)info.st_size;
+            nameHeapLoad(heap);
+        }
+    }
+    flock(fileno(heap->filePtr), LOCK_UN);
+    return ref;
+}
+
+// convert a version 2 record to the in-memory form
+void unpackRecord(struct recordStore *store, const struct packedRecord *packed, struct clientData *client) {
+    memset(client, 0, sizeof(*client));
+    if (packed->acctNum == 0) {
+        return;
+    }
+    client->acctNum = packed->acctNum;
+    client->balance = packed->balance;
+    nameHeapGet(&store->names, packed->nameRef, client);
+}
+
+// read one record straight from the file; blank if past end of file
+int fileReadRecord(struct recordStore *store, unsigned int account, struct clientData *client) {
+    struct clientData blankClient = {0, "", "", 0};
+    size_t slot = localSlot(store, account);
+    off_t offset = store->dataOffset + (off_t)(slot * store->recordSize);
+    int stable;
+    TRACE_SPAN("read record", "read");
+
+    // pread rather than stdio, whose buffer may hold bytes from before
+    // another engine's last write
+    if ((stable = readSlot(store, fileno(store->filePtr), slot, store->rawBatch)) < 0) {
+        *client = blankClient;
+        return 0;
+    }
+    // a stable read that fails its checksum is corrupt; otherwise the
+    // mismatch may be another engine between writing the record and its
+    // checksum, so look again after a moment before reporting it
+    if (!checksumVerify(&store->checksums, slot, store->rawBatch, store->recordSize, stable) && !stable) {
+        usleep(CHECKSUM_RETRY_US);
+        if (pread(fileno(store->filePtr), store->rawBatch, store->recordSize, offset) != (ssize_t)store->recordSize) {
+            *client = blankClient;
+            return 0;
+        }
+        checksumVerify(&store->checksums, slot, store->rawBatch, store->recordSize, 1);
+    }
+    if (store->version == FILE_VERSION) {
+        unpackRecord(store, (const struct packedRecord *)store->rawBatch, client);
+    } else {
+        decodeRecord((const struct diskRecord *)store->rawBatch, client);
+    }
+    sanitizeString(client->lastName, sizeof(client->lastName));
+    sanitizeString(client->firstName, sizeof(client->firstName));
+    return 1;
+}
+
+// the on-disk bytes of client in this store's layout: a tagged cents
+// record for version 1 files, a packed record whose names are interned
+// in the name heap for version 2. Returns the record size.
+size_t encodeSlot(struct recordStore *store, const struct clientData *client, unsigned char *raw) {
+    if (store->version == FILE_VERSION) {
+        struct packedRecord packed = {0, 0, 0};
+
+        if (client->acctNum != 0 && store->names.filePtr != NULL) {
+            packed.acctNum = client->acctNum;
+            packed.nameRef = nameHeapIntern(&store->names, client);
+            packed.balance = client->balance;
+        }
+        memcpy(raw, &packed, sizeof(packed));
+        return sizeof(packed);
+    }
+    encodeRecord(client, (struct diskRecord *)raw);
+    return sizeof(struct diskRecord);
+}
+
+// keep a version 2 header's record count in step when the file grows to
+// slots records; another engine may have grown it further already
+void growRecordCount(struct recordStore *store, size_t slots) {
+    if (store->version != FILE_VERSION || slots <= store->header.recordCount) {
+        return;
+    }
+    readFileHeader(store->filePtr, &store->header);
+    if (slots > store->header.recordCount) {
+        store->header.recordCount = slots;
+        fseek(store->filePtr, 0, SEEK_SET);
+        fwrite(&store->header, sizeof(struct fileHeader), 1, store->filePtr);
+    }
+}
+
+// write one record straight to the file
+void fileWriteRecord(struct recordStore *store, unsigned int account, const struct clientData *client) {
+    size_t size = encodeSlot(store, client, store->rawBatch), slot = localSlot(store, account);
+    TRACE_SPAN("write record", "write");
+
+    versionBegin(store, slot);
+    fseek(store->filePtr, store->dataOffset + (long)(slot * store->recordSize), SEEK_SET);
+    fwrite(store->rawBatch, size, 1, store->filePtr);
+    fflush(store->filePtr); // the checksum must not get ahead of the data
+    checksumUpdate(&store->checksums, slot, store->rawBatch, size);
+    versionEnd(store, slot);
+    growRecordCount(store, slot + 1);
+}
+
+// append the staged entries to the journal at their LSNs' positions,
+// synced to disk with I7_DURABLE; returns 0 if any step failed
+int stdioJournalWrite(struct recordStore *store) {
+    TRACE_SPAN("journal flush", "journal");
+
+    if (fseek(store->journalPtr, (long)((store->pending[0].lsn - 1) * sizeof(struct journalEntry)), SEEK_SET) != 0 ||
+        fwrite(store->pending, sizeof(struct journalEntry), store->pendingCount, store->journalPtr) !=
+            store->pendingCount ||
+        fflush(store->journalPtr) != 0) {
+        clearerr(store->journalPtr);
+        return 0;
+    }
+    return !store->durable || fdatasync(fileno(store->journalPtr)) == 0;
+}
+
+// stdio backend: drop buffered bytes that predate the new scan
+void stdioRewind(struct recordStore *store) {
+    fflush(store->filePtr);
+    fseek(store->filePtr, store->dataOffset, SEEK_SET);
+}
+
+// stdio backend: read the next batch where the stream stands
+size_t stdioScanRead(struct recordStore *store, size_t count) {
+    return fread(store->rawBatch, store->recordSize, count, store->filePtr);
+}
+
+// stdio backend: the journal first, then the records one by one
+int stdioCommit(struct recordStore *store, const struct recordWrite *writes, size_t count) {
+    size_t i;
+
+    if (store->pendingCount > 0 && !stdioJournalWrite(store)) {
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        fileWriteRecord(store, writes[i].account, writes[i].record);
+    }
+    return 1;
+}
+
+const struct storeBackend stdioBackend = {"stdio", stdioRewind, stdioScanRead, stdioCommit};
+
+#ifdef I7_URING
+// unmap and close ring
+void ringClose(struct ioRing *ring) {
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqEntries * sizeof(struct io_uring_sqe));
+    }
+    if (ring->cqRing != NULL && ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing) {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    if (ring->sqRing != NULL && ring->sqRing != MAP_FAILED) {
+        munmap(ring->sqRing, ring->sqRingSize);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    free(ring->readAhead);
+    free(ring->writeBatch);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+// set up ring and register its buffers; returns 0 if the kernel has no
+// io_uring or does not allow it here
+int ringOpen(struct ioRing *ring) {
+    struct io_uring_params params;
+    struct iovec buffers[2];
+    char *sq, *cq;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    ring->aheadOffset = -1;
+    if ((ring->fd = (int)syscall(__NR_io_uring_setup, RING_DEPTH, &params)) < 0) {
+        ring->fd = -1;
+        return 0;
+    }
+    ring->sqEntries = params.sq_entries;
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cqRingSize > ring->sqRingSize) {
+            ring->sqRingSize = ring->cqRingSize;
+        }
+        ring->cqRingSize = ring->sqRingSize;
+    }
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    ring->cqRing = params.features & IORING_FEAT_SINGLE_MMAP
+                       ? ring->sqRing
+                       : mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                              IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    ring->readAhead = malloc(SCAN_BATCH * sizeof(struct diskRecord));
+    ring->writeBatch = malloc(RING_WRITE_BATCH * sizeof(struct diskRecord));
+    if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED ||
+        ring->readAhead == NULL || ring->writeBatch == NULL) {
+        ringClose(ring);
+        return 0;
+    }
+    sq = ring->sqRing;
+    cq = ring->cqRing;
+    ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+    ring->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    buffers[0].iov_base = ring->readAhead;
+    buffers[0].iov_len = SCAN_BATCH * sizeof(struct diskRecord);
+    buffers[1].iov_base = ring->writeBatch;
+    buffers[1].iov_len = RING_WRITE_BATCH * sizeof(struct diskRecord);
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, buffers, 2) != 0) {
+        ringClose(ring);
+        return 0;
+    }
+    return 1;
+}
+
+// queue one operation tagged tag; it goes to the kernel at the next ringWait
+struct io_uring_sqe *ringQueue(struct ioRing *ring, int opcode, int fd, void *buffer, size_t length, off_t offset,
+                               unsigned long long tag) {
+    unsigned tail = *ring->sqTail, index = tail & ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (unsigned char)opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buffer;
+    sqe->len = (unsigned)length;
+    sqe->off = (unsigned long long)offset;
+    sqe->user_data = tag;
+    ring->sqArray[index] = index;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->results[tag] = -ECANCELED; // until it completes
+    ring->queued++;
+    if (tag != RING_TAG_PREFETCH) {
+        ring->inflight++;
+    }
+    return sqe;
+}
+
+// submit what is queued and collect completions until every operation
+// but the read-ahead has finished (the read-ahead too if ahead is set);
+// returns 0 if the kernel refused
+int ringWait(struct ioRing *ring, int ahead) {
+    for (;;) {
+        unsigned head = *ring->cqHead;
+        int submitted;
+
+        while (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+            const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqMask];
+
+            if (cqe->user_data == RING_TAG_PREFETCH) {
+                ring->aheadPending = 0;
+            } else {
+                ring->inflight--;
+            }
+            ring->results[cqe->user_data] = cqe->res;
+            head++;
+        }
+        __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+        if (ring->queued == 0 && ring->inflight == 0 && !(ahead && ring->aheadPending)) {
+            return 1;
+        }
+        submitted = (int)syscall(__NR_io_uring_enter, ring->fd, ring->queued,
+                                 ring->inflight > 0 || (ahead && ring->aheadPending) ? 1 : 0,
+                                 IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        ring->submits++;
+        ring->operations += (unsigned)submitted;
+        ring->queued -= (unsigned)submitted;
+    }
+}
+
+// io_uring backend: forget the read-ahead, which predates the new scan's view
+void ringRewind(struct recordStore *store) {
+    fflush(store->filePtr);
+    store->ring.aheadOffset = -1;
+}
+
+// io_uring backend: the batch is normally in the read-ahead buffer
+// already, read while the caller worked on the last one; otherwise it
+// is read now, with the batch after it queued in the same submission.
+// Each full batch queues the next.
+size_t ringScanRead(struct recordStore *store, size_t count) {
+    struct ioRing *ring = &store->ring;
+    int fd = fileno(store->filePtr), bytes = -1;
+    off_t offset = store->dataOffset + (off_t)(store->scanSlot * store->recordSize);
+    size_t length = count * store->recordSize;
+    struct io_uring_sqe *sqe;
+
+    if (ring->aheadPending && !ringWait(ring, 1)) {
+        return stdioScanRead(store, count);
+    }
+    if (ring->aheadOffset == offset && ring->aheadLength == length &&
+        (bytes = ring->results[RING_TAG_PREFETCH]) >= 0) {
+        memcpy(store->rawBatch, ring->readAhead, (size_t)bytes);
+    } else {
+        ringQueue(ring, IORING_OP_READ, fd, store->rawBatch, length, offset, RING_TAG_READ);
+        bytes = -1;
+    }
+    ring->aheadOffset = -1;
+    if (bytes < 0 || (size_t)bytes == length) {
+        sqe = ringQueue(ring, IORING_OP_READ_FIXED, fd, ring->readAhead, length, offset + (off_t)length,
+                        RING_TAG_PREFETCH);
+        sqe->buf_index = 0;
+        ring->aheadOffset = offset + (off_t)length;
+        ring->aheadLength = length;
+        ring->aheadPending = 1;
+    }
+    if (!ringWait(ring, 0)) {
+        ring->aheadOffset = -1;
+        return bytes >= 0 ? (size_t)bytes / store->recordSize
+                          : (size_t)pread(fd, store->rawBatch, length, offset) / store->recordSize;
+    }
+    if (bytes < 0 && (bytes = ring->results[RING_TAG_READ]) < 0) {
+        bytes = 0;
+    }
+    return (size_t)bytes / store->recordSize;
+}
+
+// io_uring backend: the journal append (with I7_DURABLE an fdatasync linked
+// to it) is submitted and checked first; an append the ring could not
+// finish is written again through stdio, and if that fails too no record
+// is written. The record writes then go to the kernel in batches of
+// RING_WRITE_BATCH, run in parallel. Checksums follow the writes once
+// they complete, and anything that did not complete is written again
+// through stdio.
+int ringCommit(struct recordStore *store, const struct recordWrite *writes, size_t count) {
+    struct ioRing *ring = &store->ring;
+    int fd = fileno(store->filePtr);
+    size_t done = 0, grown = 0, batch, i;
+    struct io_uring_sqe *sqe;
+    TRACE_SPAN("ring commit", "write");
+
+    if (store->pendingCount > 0) {
+        sqe = ringQueue(ring, IORING_OP_WRITE, fileno(store->journalPtr), store->pending,
+                        store->pendingCount * sizeof(struct journalEntry),
+                        (off_t)((store->pending[0].lsn - 1) * sizeof(struct journalEntry)), RING_TAG_JOURNAL);
+        if (store->durable) {
+            sqe->flags |= IOSQE_IO_LINK;
+            sqe = ringQueue(ring, IORING_OP_FSYNC, fileno(store->journalPtr), NULL, 0, 0, RING_TAG_SYNC);
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        }
+        if (!ringWait(ring, 0)) {
+            ring->queued = ring->inflight = 0; // the ring is unusable; commit through stdio
+            store->io = &stdioBackend;
+            return stdioCommit(store, writes, count);
+        }
+        if ((ring->results[RING_TAG_JOURNAL] != (int)(store->pendingCount * sizeof(struct journalEntry)) ||
+             (store->durable && ring->results[RING_TAG_SYNC] < 0)) &&
+            !stdioJournalWrite(store)) {
+            return 0;
+        }
+    }
+    do {
+        batch = count - done < RING_WRITE_BATCH ? count - done : RING_WRITE_BATCH;
+        for (i = 0; i < batch; i++) {
+            unsigned char *raw = ring->writeBatch + i * store->recordSize;
+            size_t slot = localSlot(store, writes[done + i].account);
+
+            encodeSlot(store, writes[done + i].record, raw);
+            versionBegin(store, slot);
+            sqe = ringQueue(ring, IORING_OP_WRITE_FIXED, fd, raw, store->recordSize,
+                            store->dataOffset + (off_t)(slot * store->recordSize), RING_TAG_WRITE + i);
+            sqe->buf_index = 1;
+        }
+        if (!ringWait(ring, 0)) {
+            ring->queued = ring->inflight = 0; // the ring is unusable; finish through stdio
+            store->io = &stdioBackend;
+        }
+        for (i = 0; i < batch; i++) {
+            size_t slot = localSlot(store, writes[done + i].account);
+
+            if (ring->results[RING_TAG_WRITE + i] != (int)store->recordSize) {
+                fileWriteRecord(store, writes[done + i].account, writes[done + i].record);
+            } else {
+                checksumUpdate(&store->checksums, slot, ring->writeBatch + i * store->recordSize, store->recordSize);
+                if (slot + 1 > grown) {
+                    grown = slot + 1;
+                }
+            }
+            versionEnd(store, slot);
+        }
+        done += batch;
+    } while (done < count);
+    growRecordCount(store, grown);
+    return 1;
+}
+
+const struct storeBackend uringBackend = {"io_uring", ringRewind, ringScanRead, ringCommit};
+#endif
+
+// start a sequential scan at slot 0, as of the last committed journal entry
+void rewindRecords(struct recordStore *store) {
+    size_t i;
+
+    viewBegin(store);
+    for (i = 0; i < store->shardCount; i++) {
+        struct recordStore *shard = &store->shards[i];
+
+        shard->io->rewind(shard);
+        shard->scanSlot = 0;
+    }
+    store->scanSlot = 0;
+}
+
+// read the next count records of one shard's file; see readRecords.
+// A shard leaves account validation to the merged batch, as its slots
+// are not the accounts' own, and only clears the records that fail
+// their checksums.
+size_t readShardRecords(struct recordStore *store, struct clientData *batch, size_t count) {
+    size_t got = store->io->scanRead(store, count), i;
+    unsigned long long patched[SCAN_BATCH / 64] = {0}; // bit i: record i came from the view
+
+    // every change visible in the batch was journalled before it was
+    // written, so catching up after the read covers all of them
+    viewCatchUp(store);
+
+    for (i = 0; i < got; i++) {
+        if (store->version == FILE_VERSION) {
+            const struct packedRecord *packed = (const struct packedRecord *)store->rawBatch + i;
+            store->batchAcct[i] = packed->acctNum;
+            store->batchBalance[i] = packed->balance;
+            if (packed->acctNum == 0) {
+                batch[i].acctNum = 0;
+                continue;
+            }
+            unpackRecord(store, packed, &batch[i]);
+        } else {
+            const struct diskRecord *disk = (const struct diskRecord *)store->rawBatch + i;
+            if (disk->acctNum == 0) {
+                batch[i].acctNum = 0;
+                store->batchAcct[i] = 0;
+                store->batchBalance[i] = 0;
+                continue;
+            }
+            decodeRecord(disk, &batch[i]);
+            store->batchAcct[i] = batch[i].acctNum;
+            store->batchBalance[i] = batch[i].balance;
+        }
+        sanitizeString(batch[i].lastName, sizeof(batch[i].lastName));
+        sanitizeString(batch[i].firstName, sizeof(batch[i].firstName));
+    }
+    for (i = 0; store->view.count > 0 && i < got; i++) {
+        if (viewPatch(store, slotAccount(store, store->scanSlot + i), &batch[i])) {
+            patched[i / 64] |= 1ULL << (i % 64);
+            store->batchAcct[i] = batch[i].acctNum;
+            store->batchBalance[i] = batch[i].balance;
+        }
+    }
+
+    if (store->stride == 1) {
+        validateBlock(store->batchAcct, store->batchBalance, store->scanSlot, got, store->batchValid);
+    } else {
+        memset(store->batchValid, 0xff, (got + 63) / 64 * sizeof(unsigned long long));
+    }
+
+    // records that fail their checksum are left out of the scan. Those
+    // taken from the view are not checked, as the file may hold a newer
+    // record whose checksum is still being written; nor are records that
+    // another engine rewrote after the batch was read, whose checksum
+    // already describes the new bytes.
+    pthread_mutex_lock(&store->checksums.lock);
+    if (got > 0 && checksumCover(&store->checksums, store->scanSlot, 0)) {
+        struct checksumFile *sums = &store->checksums;
+        for (i = 0; i < got && store->scanSlot + i < sums->slots; i++) {
+            const unsigned char *raw = store->rawBatch + i * store->recordSize;
+            unsigned int stored = sums->crc[store->scanSlot + i];
+            unsigned char current[sizeof(struct diskRecord)];
+
+            if (stored != 0 && !(patched[i / 64] >> (i % 64) & 1) && stored != crc32c(raw, store->recordSize) &&
+                pread(fileno(store->filePtr), current, store->recordSize,
+                      store->dataOffset + (off_t)((store->scanSlot + i) * store->recordSize)) ==
+                    (ssize_t)store->recordSize &&
+                memcmp(current, raw, store->recordSize) == 0) {
+                checksumFailed(sums, store->scanSlot + i);
+                store->batchValid[i / 64] &= ~(1ULL << (i % 64));
+            }
+        }
+    }
+    pthread_mutex_unlock(&store->checksums.lock);
+
+    store->scanSlot += got;
+    return got;
+}
+
+// worker of one shard: run each posted job until told to stop
+void *shardWorkerThread(void *context) {
+    struct recordStore *shard = context;
+    struct shardWorker *worker = &shard->worker;
+
+    pthread_mutex_lock(&worker->lock);
+    for (;;) {
+        while (worker->job == NULL && !worker->stop) {
+            pthread_cond_wait(&worker->wake, &worker->lock);
+        }
+        if (worker->job == NULL) {
+            break;
+        }
+        pthread_mutex_unlock(&worker->lock);
+        worker->job(shard);
+        pthread_mutex_lock(&worker->lock);
+        worker->job = NULL;
+        pthread_cond_signal(&worker->done);
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return NULL;
+}
+
+// run job on every shard at once, each on its own worker (or inline if
+// the worker could not be started), and wait for all of them
+void shardRunAll(struct recordStore *store, void (*job)(struct recordStore *shard)) {
+    size_t i;
+
+    for (i = 0; i < store->shardCount; i++) {
+        struct shardWorker *worker = &store->shards[i].worker;
+
+        if (!worker->running) {
+            job(&store->shards[i]);
+            continue;
+        }
+        pthread_mutex_lock(&worker->lock);
+        worker->job = job;
+        pthread_cond_signal(&worker->wake);
+        pthread_mutex_unlock(&worker->lock);
+    }
+    for (i = 0; i < store->shardCount; i++) {
+        struct shardWorker *worker = &store->shards[i].worker;
+
+        if (worker->running) {
+            pthread_mutex_lock(&worker->lock);
+            while (worker->job != NULL) {
+                pthread_cond_wait(&worker->done, &worker->lock);
+            }
+            pthread_mutex_unlock(&worker->lock);
+        }
+    }
+}
+
+// scan job: read the shard's part of the current batch
+void shardScanJob(struct recordStore *shard) {
+    shard->shardGot = readShardRecords(shard, shard->shardBatch, shard->shardWant);
+}
+
+// read the next (at most SCAN_BATCH) records of a sequential scan in
+// memory form, with names already sanitized; blank slots come back with
+// acctNum 0. Records changed since rewindRecords come back as they were
+// then. The whole batch is validated in one pass into batchValid, so
+// callers test recordValid instead of checking record by record.
+// A sharded store reads count / shardCount slots of every shard in
+// parallel, all from the same shard slot, and interleaves them: record
+// k of shard s is slot k * shardCount + s of the batch, so callers see
+// the accounts in order as if there were a single file. count must be
+// at least the shard count. Returns how many slots were read, 0 at end
+// of file.
+size_t readRecords(struct recordStore *store, struct clientData *batch, size_t count) {
+    size_t per = count / store->shardCount, local = store->scanSlot / store->shardCount, longest = 0, s, k;
+
+    if (store->shards == store) {
+        return readShardRecords(store, batch, count);
+    }
+    TRACE_SPAN("read shards", "read");
+    for (s = 0; s < store->shardCount; s++) {
+        struct recordStore *shard = &store->shards[s];
+
+        if (shard->scanSlot != local) { // ran out in an earlier batch
+            fseek(shard->filePtr, shard->dataOffset + (long)(local * shard->recordSize), SEEK_SET);
+            shard->scanSlot = local;
+        }
+        shard->shardWant = per;
+    }
+    shardRunAll(store, shardScanJob);
+
+    for (s = 0; s < store->shardCount; s++) {
+        if (store->shards[s].shardGot > longest) {
+            longest = store->shards[s].shardGot;
+        }
+    }
+    for (s = 0; s < store->shardCount; s++) {
+        const struct recordStore *shard = &store->shards[s];
+
+        for (k = 0; k < longest; k++) {
+            size_t slot = k * store->shardCount + s;
+
+            if (k < shard->shardGot) {
+                batch[slot] = shard->shardBatch[k];
+                // a record that failed its checksum fails validation too
+                store->batchAcct[slot] = shard->batchValid[k / 64] >> (k % 64) & 1 ? shard->batchAcct[k] : 0;
+                store->batchBalance[slot] = shard->batchBalance[k];
+            } else {
+                batch[slot].acctNum = 0; // past the end of this shard
+                store->batchAcct[slot] = 0;
+                store->batchBalance[slot] = 0;
+            }
+        }
+    }
+    validateBlock(store->batchAcct, store->batchBalance, store->scanSlot, longest * store->shardCount,
+                  store->batchValid);
+    store->scanSlot += longest * store->shardCount;
+    return longest * store->shardCount;
+}
+
+// whether record i of the last readRecords batch passed validation
+int recordValid(const struct recordStore *store, size_t i) {
+    return (int)(store->batchValid[i / 64] >> (i % 64)) & 1;
+}
+
+// Convert every double balance record of a version 1 fileName to cents
+// in place, a batch at a time. Each batch is done under the journal lock
+// so running engines never see a half-written batch; records that are
+// blank or already tagged are left alone, so an interrupted run can
+// simply be started again. Version 2 files always hold cents. Checksums
+// of converted records are updated in the checksum file, if there is one,
+// after the records themselves, and both writes are bracketed in
+// credit.seq so readers retry rather than pair a record with a stale
+// checksum. Returns the number of records converted, or -1.
+long migrateCents(const char *fileName) {
+    char crcPath[512], journalPath[512];
+    FILE *fPtr = fopen(fileName, "rb+");
+    FILE *lockPtr;
+    int crcFd;
+    struct diskRecord *batch = malloc(SCAN_BATCH * sizeof(struct diskRecord));
+    unsigned char *convertedSlot = malloc(SCAN_BATCH);
+    struct recordStore sequence; // only its credit.seq stripes are used
+    struct clientData client;
+    struct fileHeader header;
+    long converted = 0, offset = 0;
+    size_t got, slot, i;
+    int changed, packed;
+
+    sidecarFileName(fileName, ".jnl", journalPath, sizeof(journalPath));
+    lockPtr = fopen(journalPath, "a+b");
+
+    if (fPtr == NULL || batch == NULL || convertedSlot == NULL) {
+        if (fPtr != NULL) {
+            fclose(fPtr);
+        }
+        if (lockPtr != NULL) {
+            fclose(lockPtr);
+        }
+        free(batch);
+        free(convertedSlot);
+        return -1;
+    }
+    packed = readFileHeader(fPtr, &header);
+    sidecarFileName(fileName, ".crc", crcPath, sizeof(crcPath));
+    crcFd = open(crcPath, O_RDWR);
+    versionOpen(&sequence, fileName);
+
+    do {
+        if (lockPtr != NULL) {
+            flock(fileno(lockPtr), LOCK_EX);
+        }
+        fseek(fPtr, offset, SEEK_SET);
+        got = packed ? 0 : fread(batch, sizeof(struct diskRecord), SCAN_BATCH, fPtr);
+        slot = (size_t)offset / sizeof(struct diskRecord);
+        changed = 0;
+        for (i = 0; i < got; i++) {
+            // (a balance that is not an amount is left as it is)
+            convertedSlot[i] = batch[i].acctNum != 0 &&
+                               memcmp(batch[i].tag, CENTS_TAG, sizeof(batch[i].tag)) != 0 &&
+                               centsFromAmount(batch[i].balance.amount, &client.balance);
+            if (convertedSlot[i]) {
+                decodeRecord(&batch[i], &client);
+                encodeRecord(&client, &batch[i]);
+                versionBegin(&sequence, slot + i);
+                changed = 1;
+                converted++;
+            }
+        }
+        if (changed) {
+            fseek(fPtr, offset, SEEK_SET);
+            fwrite(batch, sizeof(struct diskRecord), got, fPtr);
+            fflush(fPtr);
+            for (i = 0; i < got; i++) {
+                if (!convertedSlot[i]) {
+                    continue;
+                }
+                // (a checksum file too short for the slot has none for it)
+                if (crcFd >= 0) {
+                    unsigned int crc = crc32c(&batch[i], sizeof(struct diskRecord));
+                    off_t crcOffset = (off_t)((slot + i) * sizeof(crc));
+                    struct stat info;
+                    if (fstat(crcFd, &info) == 0 && crcOffset < info.st_size) {
+                        pwrite(crcFd, &crc, sizeof(crc), crcOffset);
+                    }
+                }
+                versionEnd(&sequence, slot + i);
+            }
+        }
+        if (lockPtr != NULL) {
+            flock(fileno(lockPtr), LOCK_UN);
+        }
+        offset += (long)(got * sizeof(struct diskRecord));
+    } while (got == SCAN_BATCH);
+
+    fsync(fileno(fPtr));
+    fclose(fPtr);
+    if (crcFd >= 0) {
+        close(crcFd);
+    }
+    if (sequence.versions != NULL) {
+        munmap(sequence.versions, VERSION_STRIPES * sizeof(unsigned long long));
+        close(sequence.versionFd);
+    }
+    if (lockPtr != NULL) {
+        fclose(lockPtr);
+    }
+    free(batch);
+    free(convertedSlot);
+    return converted;
+}
+
+// Rewrite a version 1 fileName as a version 2 file: a header, 16-byte
+// records, a name heap and a checksum file next to it. All are written
+// under temporary names and renamed into place, the heap first, so an
+// interrupted run leaves the version 1 file untouched and can be
+// repeated; the old checksums are removed before the data is replaced.
+// Engines must not be running, since they keep the old file open.
+// Returns the number of records converted, or -1.
+long migrateVersion2(const char *fileName) {
+    char namesPath[512], dataTemp[520], namesTemp[520], crcPath[512], crcTemp[520];
+    FILE *fPtr = fopen(fileName, "rb");
+    FILE *dataPtr = NULL, *crcPtr = NULL;
+    unsigned int crc;
+    struct nameHeap names;
+    struct diskRecord *batch = malloc(SCAN_BATCH * sizeof(struct diskRecord));
+    struct packedRecord *packed = malloc(SCAN_BATCH * sizeof(struct packedRecord));
+    struct fileHeader header;
+    struct clientData client;
+    long converted = 0;
+    size_t got, i;
+    int ok = 0;
+
+    memset(&names, 0, sizeof(names));
+    sidecarFileName(fileName, ".names", namesPath, sizeof(namesPath));
+    snprintf(dataTemp, sizeof(dataTemp), "%s.tmp", fileName);
+    snprintf(namesTemp, sizeof(namesTemp), "%s.tmp", namesPath);
+    sidecarFileName(fileName, ".crc", crcPath, sizeof(crcPath));
+    snprintf(crcTemp, sizeof(crcTemp), "%s.tmp", crcPath);
+
+    if (fPtr != NULL && readFileHeader(fPtr, &header)) {
+        fclose(fPtr);
+        free(batch);
+        free(packed);
+        return 0; // already version 2
+    }
+    if (fPtr != NULL && batch != NULL && packed != NULL &&
+        (dataPtr = fopen(dataTemp, "wb")) != NULL && (names.filePtr = fopen(namesTemp, "w+b")) != NULL &&
+        (crcPtr = fopen(crcTemp, "wb")) != NULL) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+        header.version = FILE_VERSION;
+        header.recordSize = sizeof(struct packedRecord);
+        header.flags = FILE_FLAG_CENTS;
+        fwrite(&header, sizeof(header), 1, dataPtr);
+        fwrite(NAME_HEAP_MAGIC, 1, sizeof(NAME_HEAP_MAGIC) - 1, names.filePtr);
+        fflush(names.filePtr);
+
+        rewind(fPtr);
+        while ((got = fread(batch, sizeof(struct diskRecord), SCAN_BATCH, fPtr)) > 0) {
+            memset(packed, 0, got * sizeof(struct packedRecord));
+            for (i = 0; i < got; i++) {
+                if (batch[i].acctNum == 0) {
+                    continue;
+                }
+                decodeRecord(&batch[i], &client);
+                packed[i].acctNum = client.acctNum;
+                packed[i].nameRef = nameHeapIntern(&names, &client);
+                packed[i].balance = client.balance;
+                converted++;
+            }
+            fwrite(packed, sizeof(struct packedRecord), got, dataPtr);
+            for (i = 0; i < got; i++) {
+                crc = crc32c(&packed[i], sizeof(struct packedRecord));
+                fwrite(&crc, sizeof(crc), 1, crcPtr);
+            }
+            header.recordCount += got;
+        }
+
+        // the record count is only known at the end
+        fseek(dataPtr, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, dataPtr);
+        ok = fflush(dataPtr) == 0 && fflush(names.filePtr) == 0 && fflush(crcPtr) == 0 && !ferror(dataPtr) &&
+             !ferror(names.filePtr) && !ferror(crcPtr) && fsync(fileno(dataPtr)) == 0 &&
+             fsync(fileno(names.filePtr)) == 0 && fsync(fileno(crcPtr)) == 0;
+    }
+
+    if (crcPtr != NULL) {
+        fclose(crcPtr);
+    }
+    if (names.filePtr != NULL) {
+        fclose(names.filePtr);
+    }
+    free(names.data);
+    free(names.table);
+    if (dataPtr != NULL) {
+        fclose(dataPtr);
+    }
+    if (fPtr != NULL) {
+        fclose(fPtr);
+    }
+    free(batch);
+    free(packed);
+    if (!ok || rename(namesTemp, namesPath) != 0 || (remove(crcPath) != 0 && errno != ENOENT) ||
+        rename(dataTemp, fileName) != 0) {
+        remove(dataTemp);
+        remove(namesTemp);
+        remove(crcTemp);
+        return -1;
+    }
+    rename(crcTemp, crcPath);
+    return converted;
+}
+
+// LSN of the last complete entry in the journal
+unsigned long long journalEnd(struct recordStore *store) {
+    struct stat info;
+
+    if (store->journalPtr == NULL || fstat(fileno(store->journalPtr), &info) != 0) {
+        return 0;
+    }
+    return (unsigned long long)info.st_size / sizeof(struct journalEntry);
+}
+
+// LSN of the last entry of a finished commit: the length is read under a
+// shared journal lock, so no entry below it is still being written. Not
+// for an engine holding the lock itself (flock would convert it).
+unsigned long long journalCommitted(struct recordStore *store) {
+    unsigned long long end;
+
+    if (store->journalPtr == NULL) {
+        return 0;
+    }
+    flock(fileno(store->journalPtr), LOCK_SH);
+    end = journalEnd(store);
+    flock(fileno(store->journalPtr), LOCK_UN);
+    return end;
+}
+
+// The store's change counter: committed journal entries, summed over its
+// shards. Every change adds to it, so an unchanged version means an
+// unchanged store (until the store is split into shards, which starts
+// new journals). main.py reads it the same way, from the journal lengths,
+// to key its response caches.
+unsigned long long storeVersion(struct recordStore *store) {
+    unsigned long long version = 0;
+    size_t i;
+
+    for (i = 0; i < store->shardCount; i++) {
+        version += journalCommitted(&store->shards[i]);
+    }
+    return version;
+}
+
+// read journal entry lsn; returns 0 if it is not there. Read past stdio:
+// a seek into the stream's buffer would return bytes buffered before
+// another engine appended the entry.
+int journalRead(struct recordStore *store, unsigned long long lsn, struct journalEntry *entry) {
+    return pread(fileno(store->journalPtr), entry, sizeof(struct journalEntry),
+                 (off_t)((lsn - 1) * sizeof(struct journalEntry))) == (ssize_t)sizeof(struct journalEntry);
+}
+
+// pick up entries other engine processes appended since we last looked,
+// refreshing any clean cached copies of the accounts they changed
+void journalCatchUp(struct recordStore *store) {
+    unsigned long long end = journalEnd(store);
+    struct journalEntry entry;
+
+    for (; store->journalLsn < end; store->journalLsn++) {
+        int index;
+
+        if (!journalRead(store, store->journalLsn + 1, &entry) || entry.lsn != store->journalLsn + 1) {
+            break; // torn, or not yet fully written
+        }
+        if (store->cacheSize > 0 && (index = cacheFind(store, entry.account)) != -1 &&
+            !store->entries[index].dirty) {
+            store->entries[index].record = entry.record;
+        }
+    }
+}
+
+// the record before the change entry describes
+void journalBeforeImage(const struct journalEntry *entry, struct clientData *client) {
+    struct clientData blankClient = {0, "", "", 0};
+
+    if (entry->op == JOURNAL_NEW) {
+        *client = blankClient;
+        return;
+    }
+    *client = entry->record; // names are unchanged by updates and kept by deletes
+    client->acctNum = entry->account;
+    client->balance = entry->oldBalance;
+}
+
+// slot of account in the view's table, or of the empty slot where it goes
+size_t viewSlot(const struct readView *view, unsigned int account) {
+    size_t slot = (account * 2654435761u) & view->mask;
+
+    while (view->accounts[slot] != 0 && view->accounts[slot] != account) {
+        slot = (slot + 1) & view->mask;
+    }
+    return slot;
+}
+
+// add account as it was before entry, unless an earlier entry already did;
+// the table doubles when half full
+void viewAdd(struct readView *view, const struct journalEntry *entry) {
+    size_t slot;
+
+    if (view->accounts == NULL || 2 * (view->count + 1) > view->mask + 1) {
+        size_t newSize = view->accounts ? 2 * (view->mask + 1) : 1024, i;
+        struct readView grown = *view;
+        grown.accounts = calloc(newSize, sizeof(unsigned int));
+        grown.images = malloc(newSize * sizeof(struct clientData));
+        grown.mask = newSize - 1;
+        if (grown.accounts == NULL || grown.images == NULL) {
+            free(grown.accounts);
+            free(grown.images);
+            return;
+        }
+        for (i = 0; view->accounts != NULL && i <= view->mask; i++) {
+            if (view->accounts[i] != 0) {
+                slot = viewSlot(&grown, view->accounts[i]);
+                grown.accounts[slot] = view->accounts[i];
+                grown.images[slot] = view->images[i];
+            }
+        }
+        free(view->accounts);
+        free(view->images);
+        *view = grown;
+    }
+    slot = viewSlot(view, entry->account);
+    if (view->accounts[slot] == 0) {
+        view->accounts[slot] = entry->account;
+        journalBeforeImage(entry, &view->images[slot]);
+        view->count++;
+    }
+}
+
+// Take a view as of the last committed entry. The shared journal lock
+// waits out a commit in progress, so every entry up to the view's LSN has
+// reached the file; writers are held up only for the lock round trip.
+// The shards of a sharded store take their views at one cut, with every
+// journal locked at once (in shard order; a commit locks one journal at
+// a time, so this cannot deadlock).
+void viewBegin(struct recordStore *store) {
+    size_t i;
+
+    for (i = 0; i < store->shardCount; i++) {
+        struct recordStore *shard = &store->shards[i];
+        struct readView *view = &shard->view;
+
+        if (view->count > 0) {
+            memset(view->accounts, 0, (view->mask + 1) * sizeof(unsigned int));
+            view->count = 0;
+        }
+        view->active = shard->journalPtr != NULL;
+        if (view->active) {
+            flock(fileno(shard->journalPtr), LOCK_SH);
+        }
+    }
+    for (i = 0; i < store->shardCount; i++) {
+        struct recordStore *shard = &store->shards[i];
+
+        if (shard->view.active) {
+            shard->view.lsn = shard->view.seen = journalEnd(shard);
+        }
+    }
+    for (i = 0; i < store->shardCount; i++) {
+        if (store->shards[i].view.active) {
+            flock(fileno(store->shards[i].journalPtr), LOCK_UN);
+        }
+    }
+}
+
+// fold entries committed since the last call into the view. Stops at an
+// entry still being written (its LSN not yet in place) and picks it up
+// next time; its record cannot have been written before it.
+void viewCatchUp(struct recordStore *store) {
+    struct readView *view = &store->view;
+    struct journalEntry entry;
+    unsigned long long end;
+
+    if (!view->active || (end = journalEnd(store)) <= view->seen) {
+        return;
+    }
+    for (; view->seen < end; view->seen++) {
+        if (!journalRead(store, view->seen + 1, &entry) || entry.lsn != view->seen + 1) {
+            break;
+        }
+        viewAdd(view, &entry);
+    }
+}
+
+// replace client with account as of the view if it changed since; returns
+// 1 if it did
+int viewPatch(struct recordStore *store, unsigned int account, struct clientData *client) {
+    struct readView *view = &store->view;
+    size_t slot;
+
+    if (view->count == 0 || view->accounts[slot = viewSlot(view, account)] == 0) {
+        return 0;
+    }
+    *client = view->images[slot];
+    sanitizeString(client->lastName, sizeof(client->lastName));
+    sanitizeString(client->firstName, sizeof(client->firstName));
+    view->undone++;
+    return 1;
+}
+
+// read one record by slot as of the current scan's view (the rows of a
+// sorted listing are fetched this way after the scan)
+int viewReadRecord(struct recordStore *store, unsigned int account, struct clientData *client) {
+    int found;
+
+    store = shardOf(store, account);
+    found = fileReadRecord(store, account, client);
+
+    viewCatchUp(store);
+    return viewPatch(store, account, client) || found;
+}
+
+// the newest journal entry for account; returns 0 if it has none
+int journalFindLatest(struct recordStore *store, unsigned int account, struct journalEntry *entry) {
+    unsigned long long lsn;
+
+    for (lsn = journalEnd(store); lsn > 0; lsn--) {
+        if (journalRead(store, lsn, entry) && entry->lsn == lsn && entry->account == account) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// rewrite the accounts that failed their checksums from their newest
+// journal entries; called under the journal lock
+void repairRecords(struct recordStore *store) {
+    struct checksumFile *sums = &store->checksums;
+    unsigned int queue[MAX_REPAIRS];
+    struct journalEntry entry;
+    size_t count, i;
+    int index;
+
+    pthread_mutex_lock(&sums->lock);
+    count = sums->repairCount;
+    memcpy(queue, sums->repairQueue, count * sizeof(unsigned int));
+    sums->repairCount = 0;
+    pthread_mutex_unlock(&sums->lock);
+
+    for (i = 0; i < count; i++) {
+        if (!journalFindLatest(store, queue[i], &entry)) {
+            fprintf(stderr, "i7: record %u has no journal entry to repair it from\n", queue[i]);
+            continue;
+        }
+        fileWriteRecord(store, queue[i], &entry.record);
+        if (store->cacheSize > 0 && (index = cacheFind(store, queue[i])) != -1 && !store->entries[index].dirty) {
+            store->entries[index].record = entry.record;
+        }
+        pthread_mutex_lock(&sums->lock);
+        sums->repairs++;
+        pthread_mutex_unlock(&sums->lock);
+        fprintf(stderr, "i7: record %u repaired from journal entry %llu\n", queue[i], entry.lsn);
+    }
+}
+
+// current wall clock time in milliseconds
+long long wallClockMs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// read the replication status sidecar suffix (".ship" or ".repl") of
+// fileName; returns 0 if there is none
+int readReplication(const char *fileName, const char *suffix, struct replicationStatus *status) {
+    char path[512];
+    int fd, ok;
+
+    sidecarFileName(fileName, suffix, path, sizeof(path));
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return 0;
+    }
+    ok = pread(fd, status, sizeof(*status), 0) == (ssize_t)sizeof(*status);
+    close(fd);
+    return ok;
+}
+
+// overwrite the replication status in fd; updated is when the other
+// end was last heard from
+void writeReplication(int fd, unsigned long long primaryLsn, unsigned long long standbyLsn, long long updated) {
+    struct replicationStatus status = {primaryLsn, standbyLsn, updated};
+
+    if (fd >= 0 && pwrite(fd, &status, sizeof(status), 0) != (ssize_t)sizeof(status)) {
+        fprintf(stderr, "i7: could not record the replication status\n");
+    }
+}
+
+// the LSN recorded in credit.ckpt; returns 0 if there is no valid checkpoint
+int readCheckpoint(const struct recordStore *store, unsigned long long *lsn) {
+    struct checkpointRecord ckpt;
+    char path[512];
+    FILE *ckptPtr;
+    int ok;
+
+    sidecarFileName(store->fileName, ".ckpt", path, sizeof(path));
+    ckptPtr = fopen(path, "rb");
+    ok = ckptPtr != NULL && fread(&ckpt, sizeof(ckpt), 1, ckptPtr) == 1 &&
+         memcmp(ckpt.magic, CHECKPOINT_MAGIC, sizeof(ckpt.magic)) == 0 &&
+         ckpt.crc == crc32c(&ckpt, offsetof(struct checkpointRecord, crc)) &&
+         ckpt.journalOffset == ckpt.lsn * sizeof(struct journalEntry);
+
+    if (ckptPtr != NULL) {
+        fclose(ckptPtr);
+    }
+    if (ok) {
+        *lsn = ckpt.lsn;
+    }
+    return ok;
+}
+
+// make credit.dat, its checksums and names and the journal durable, then
+// record lsn in credit.ckpt. The journal is synced too so that its end can
+// never fall behind the checkpoint. Called under the journal lock with
+// every entry up to lsn applied; returns 0 if no checkpoint was written.
+int writeCheckpoint(struct recordStore *store, unsigned long long lsn) {
+    struct checkpointRecord ckpt;
+    char path[512], temp[520];
+    FILE *ckptPtr;
+    int ok, dirFd;
+    TRACE_SPAN("checkpoint", "journal");
+
+    sidecarFileName(store->fileName, ".ckpt", path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    fflush(store->filePtr);
+    fsync(fileno(store->filePtr));
+    pthread_mutex_lock(&store->checksums.lock);
+    if (store->checksums.crc != NULL) {
+        msync(store->checksums.crc, store->checksums.slots * sizeof(unsigned int), MS_SYNC);
+    }
+    pthread_mutex_unlock(&store->checksums.lock);
+    if (store->names.filePtr != NULL) {
+        fsync(fileno(store->names.filePtr));
+    }
+    fflush(store->journalPtr);
+    fsync(fileno(store->journalPtr));
+
+    memset(&ckpt, 0, sizeof(ckpt));
+    memcpy(ckpt.magic, CHECKPOINT_MAGIC, sizeof(ckpt.magic));
+    ckpt.lsn = lsn;
+    ckpt.journalOffset = lsn * sizeof(struct journalEntry);
+    ckpt.crc = crc32c(&ckpt, offsetof(struct checkpointRecord, crc));
+    if ((ckptPtr = fopen(temp, "wb")) == NULL) {
+        return 0;
+    }
+    ok = fwrite(&ckpt, sizeof(ckpt), 1, ckptPtr) == 1 && fflush(ckptPtr) == 0 && fsync(fileno(ckptPtr)) == 0;
+    fclose(ckptPtr);
+    if (!ok || rename(temp, path) != 0) {
+        remove(temp);
+        return 0;
+    }
+    if ((dirFd = open(".", O_RDONLY)) >= 0) { // make the rename itself durable
+        fsync(dirFd);
+        close(dirFd);
+    }
+    store->checkpointLsn = lsn;
+    store->checkpoints++;
+    return 1;
+}
+
+// order journal entries by account, then by LSN
+int compareReplay(const void *a, const void *b) {
+    const struct journalEntry *x = a, *y = b;
+
+    if (x->account != y->account) {
+        return x->account < y->account ? -1 : 1;
+    }
+    return x->lsn < y->lsn ? -1 : x->lsn > y->lsn;
+}
+
+// rewrite the records of one account range whose bytes differ from the
+// journal's, and refresh their checksums
+void replayRange(void *context, size_t begin, size_t end) {
+    struct replayChunk *chunk = context;
+    struct recordStore *store = chunk->store;
+    unsigned char current[sizeof(struct diskRecord)];
+    int fd = fileno(store->filePtr);
+    unsigned long long written = 0;
+    size_t i;
+
+    for (i = begin; i < end; i++) {
+        const unsigned char *raw = chunk->raw + i * store->recordSize;
+        size_t slot = localSlot(store, chunk->entries[i].account);
+        off_t offset = store->dataOffset + (off_t)(slot * store->recordSize);
+
+        versionBegin(store, slot);
+        if (pread(fd, current, store->recordSize, offset) != (ssize_t)store->recordSize ||
+            memcmp(current, raw, store->recordSize) != 0) {
+            if (pwrite(fd, raw, store->recordSize, offset) != (ssize_t)store->recordSize) {
+                versionEnd(store, slot);
+                continue;
+            }
+            written++;
+        }
+        checksumUpdate(&store->checksums, slot, raw, store->recordSize);
+        versionEnd(store, slot);
+    }
+    __atomic_add_fetch(&chunk->written, written, __ATOMIC_RELAXED);
+}
+
+// Apply journal entries from + 1 to to onto credit.dat. Entries carry the
+// whole record after the change, so within a batch only the newest entry
+// of each account matters and accounts are independent: the batch is cut
+// down to one record per account and account ranges are rewritten on
+// the task pool. Records that already hold the right bytes are left
+// alone, so replaying entries that did reach the file costs a read.
+// Entries whose LSN does not match their position (a torn tail or an
+// old-format journal) are skipped. Called under the journal lock;
+// returns the number of records rewritten.
+unsigned long long replayJournal(struct recordStore *store, unsigned long long from, unsigned long long to) {
+    struct journalEntry *entries = malloc(REPLAY_BATCH * sizeof(struct journalEntry));
+    unsigned char *raw = malloc(REPLAY_BATCH * sizeof(struct diskRecord));
+    unsigned long long written = 0;
+    TRACE_SPAN("replay journal", "journal");
+
+    if (entries == NULL || raw == NULL) {
+        free(entries);
+        free(raw);
+        return 0;
+    }
+    fflush(store->filePtr);
+    while (from < to) {
+        struct replayChunk chunk = {store, entries, raw, 0};
+        size_t want = to - from < REPLAY_BATCH ? (size_t)(to - from) : REPLAY_BATCH;
+        size_t count = 0, unique = 0, i;
+        ssize_t bytes = pread(fileno(store->journalPtr), entries, want * sizeof(struct journalEntry),
+                              (off_t)(from * sizeof(struct journalEntry)));
+        size_t got = bytes > 0 ? (size_t)bytes / sizeof(struct journalEntry) : 0;
+
+        if (got == 0) {
+            break;
+        }
+        for (i = 0; i < got; i++) {
+            if (entries[i].lsn == from + i + 1 && entries[i].account != 0) {
+                entries[count++] = entries[i];
+            }
+        }
+        from += got;
+
+        qsort(entries, count, sizeof(struct journalEntry), compareReplay);
+        for (i = 0; i < count; i++) {
+            if (i + 1 < count && entries[i + 1].account == entries[i].account) {
+                continue; // superseded later in the batch
+            }
+            entries[unique] = entries[i];
+            encodeSlot(store, &entries[unique].record, raw + unique * store->recordSize);
+            unique++;
+        }
+        if (unique == 0) {
+            continue;
+        }
+
+        taskRun(replayRange, &chunk, 0, unique, REPLAY_GRAIN);
+        written += chunk.written;
+        growRecordCount(store, localSlot(store, entries[unique - 1].account) + 1);
+    }
+
+    free(entries);
+    free(raw);
+    store->replayed += written;
+    return written;
+}
+
+// whether the journal has run checkpointInterval entries past the last checkpoint
+int checkpointDue(const struct recordStore *store, unsigned long long lsn) {
+    return store->checkpointInterval > 0 && lsn - store->checkpointLsn >= store->checkpointInterval;
+}
+
+// Periodic checkpoint at the end of a commit, under the journal lock.
+// Another engine may have taken one already. The entries since the last
+// checkpoint are replayed first: an engine that died between writing its
+// entries and its records leaves the file behind the journal.
+void checkpointStore(struct recordStore *store) {
+    unsigned long long checkpoint;
+
+    if (readCheckpoint(store, &checkpoint) && checkpoint <= store->journalLsn && checkpoint > store->checkpointLsn) {
+        store->checkpointLsn = checkpoint;
+    }
+    if (checkpointDue(store, store->journalLsn)) {
+        replayJournal(store, store->checkpointLsn, store->journalLsn);
+        writeCheckpoint(store, store->journalLsn);
+    }
+}
+
+// LSN of the last entry after from (up to to) before the first one that
+// does not carry its own position: a torn write or a stale block
+unsigned long long journalIntactEnd(struct recordStore *store, unsigned long long from, unsigned long long to) {
+    struct journalEntry entry;
+
+    for (; from < to; from++) {
+        if (!journalRead(store, from + 1, &entry) || entry.lsn != from + 1) {
+            break;
+        }
+    }
+    return from;
+}
+
+// Crash recovery when the store opens: replay the journal entries after
+// the last checkpoint, so a crash between writing the entries of an
+// operation and writing its records loses nothing. The work is bounded
+// by the checkpoint interval, not the length of the journal. A new
+// checkpoint is written if replay had to fix anything, if the tail has
+// reached the interval, or if there was no usable checkpoint. The
+// journal ends at the last entry that carries its own position; a torn
+// tail after it is cut off.
+void recoverStore(struct recordStore *store) {
+    unsigned long long checkpoint = 0, end;
+    int found, fixed;
+
+    flock(fileno(store->journalPtr), LOCK_EX);
+    end = journalEnd(store);
+    found = readCheckpoint(store, &checkpoint);
+    if (checkpoint > end) { // the journal was cut short or replaced
+        checkpoint = end;
+        found = 0;
+    }
+    end = journalIntactEnd(store, checkpoint, end);
+    if (end < journalEnd(store)) { // a torn or stray tail: later commits append over it
+        ftruncate(fileno(store->journalPtr), (off_t)(end * sizeof(struct journalEntry)));
+    }
+    store->checkpointLsn = checkpoint;
+    fixed = replayJournal(store, checkpoint, end) > 0;
+    if (!found || fixed || checkpointDue(store, end)) {
+        writeCheckpoint(store, end);
+    }
+    store->journalLsn = end;
+    flock(fileno(store->journalPtr), LOCK_UN);
+}
+
+#define SCRUB_PAUSE_US 2000 // pause between scrub batches, in microseconds
+
+// Background scrub: walk credit.dat at the lowest CPU priority checking
+// every record against its checksum. A record that still fails when read
+// again (it may have been mid-write) is reported and queued; the main
+// thread rewrites it from the journal at its next commit.
+void *scrubThread(void *context) {
+    struct recordStore *store = context;
+    struct checksumFile *sums = &store->checksums;
+    int fd = open(store->fileName, O_RDONLY);
+    unsigned char *raw = malloc(SCAN_BATCH * store->recordSize);
+    unsigned char again[sizeof(struct diskRecord)];
+    size_t slot = 0, count = SCAN_BATCH, i;
+    ssize_t got;
+
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+    while (fd >= 0 && raw != NULL && count == SCAN_BATCH &&
+           !__atomic_load_n(&sums->scrubStop, __ATOMIC_ACQUIRE) &&
+           (got = pread(fd, raw, SCAN_BATCH * store->recordSize,
+                        store->dataOffset + (off_t)(slot * store->recordSize))) > 0) {
+        count = (size_t)got / store->recordSize;
+        for (i = 0; i < count && !__atomic_load_n(&sums->scrubStop, __ATOMIC_ACQUIRE); i++) {
+            const unsigned char *record = raw + i * store->recordSize;
+            unsigned int stored;
+
+            pthread_mutex_lock(&sums->lock);
+            stored = checksumCover(sums, slot + i, 0) ? sums->crc[slot + i] : 0;
+            pthread_mutex_unlock(&sums->lock);
+            if (stored != 0 && stored != crc32c(record, store->recordSize)) {
+                int stable = readSlot(store, fd, slot + i, again);
+
+                if (stable == 0) { // no version to go by: give a writer a moment
+                    usleep(SCRUB_PAUSE_US);
+                    stable = readSlot(store, fd, slot + i, again);
+                }
+                if (stable >= 0) {
+                    checksumVerify(sums, slot + i, again, store->recordSize, 1);
+                }
+            }
+        }
+        pthread_mutex_lock(&sums->lock);
+        sums->scrubbed += i;
+        pthread_mutex_unlock(&sums->lock);
+        slot += count;
+        usleep(SCRUB_PAUSE_US);
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(raw);
+    return NULL;
+}
+
+// stage a journal entry describing the change from oldClient to client;
+// returns 0 if there is no journal or no room to stage it
+int journalStage(struct recordStore *store, unsigned int account,
+                 const struct clientData *oldClient, const struct clientData *client) {
+    struct journalEntry *entry;
+
+    if (store->journalPtr == NULL) {
+        return 0;
+    }
+    if (store->pendingCount == store->pendingCapacity) {
+        size_t newCapacity = store->pendingCapacity ? store->pendingCapacity * 2 : 16;
+        struct journalEntry *grown = realloc(store->pending, newCapacity * sizeof(struct journalEntry));
+        if (grown == NULL) {
+            return 0;
+        }
+        store->pending = grown;
+        store->pendingCapacity = newCapacity;
+    }
+
+    entry = &store->pending[store->pendingCount++];
+    memset(entry, 0, sizeof(*entry));
+    entry->op = client->acctNum == 0 ? JOURNAL_DELETE
+              : oldClient->acctNum == 0 ? JOURNAL_NEW : JOURNAL_UPDATE;
+    entry->account = account;
+    entry->oldBalance = oldClient->balance;
+    entry->record = *client;
+    return 1;
+}
+
+// set up the store for the record file fileName, open as fPtr, and its
+// cache; I7_CACHE_SIZE overrides the cache size. A shard is opened as
+// shard shardIndex of stride and gets its share of the cache. Built with
+// -DI7_URING the store uses io_uring where the kernel allows it, unless
+// I7_URING=0.
+void openStore(struct recordStore *store, FILE *fPtr, const char *fileName, size_t shardIndex, size_t stride) {
+    char path[512];
+    const char *sizeText = getenv("I7_CACHE_SIZE");
+    const char *scrubText = getenv("I7_SCRUB");
+    const char *intervalText = getenv("I7_CHECKPOINT");
+    const char *durableText = getenv("I7_DURABLE");
+#ifdef I7_URING
+    const char *uringText = getenv("I7_URING");
+#endif
+    size_t bucketCount = 1;
+    size_t i;
+
+    memset(store, 0, sizeof(*store));
+    snprintf(store->fileName, sizeof(store->fileName), "%s", fileName);
+    store->stride = stride;
+    store->shardIndex = shardIndex;
+    store->shards = store;
+    store->shardCount = 1;
+    store->io = &stdioBackend;
+#ifdef I7_URING
+    store->ring.fd = -1;
+    if ((uringText == NULL || strcmp(uringText, "0") != 0) && ringOpen(&store->ring)) {
+        store->io = &uringBackend;
+    }
+#endif
+    store->filePtr = fPtr;
+    // version 2 files have a header and keep their names in credit.names
+    if (readFileHeader(fPtr, &store->header) && store->header.version == FILE_VERSION &&
+        store->header.recordSize == sizeof(struct packedRecord)) {
+        store->version = FILE_VERSION;
+        store->recordSize = sizeof(struct packedRecord);
+        store->dataOffset = sizeof(struct fileHeader);
+        sidecarFileName(fileName, ".names", path, sizeof(path));
+        if ((store->names.filePtr = fopen(path, "a+b")) != NULL) {
+            fseek(store->names.filePtr, 0, SEEK_END);
+            if (ftell(store->names.filePtr) == 0) {
+                fwrite(NAME_HEAP_MAGIC, 1, sizeof(NAME_HEAP_MAGIC) - 1, store->names.filePtr);
+                fflush(store->names.filePtr);
+            }
+            nameHeapLoad(&store->names);
+        }
+    } else {
+        store->version = 1;
+        store->recordSize = sizeof(struct diskRecord);
+        store->dataOffset = 0;
+    }
+    store->rawBatch = malloc(SCAN_BATCH * sizeof(struct diskRecord));
+    store->batchAcct = malloc(SCAN_BATCH * sizeof(unsigned int));
+    store->batchBalance = malloc(SCAN_BATCH * sizeof(long long));
+    if (store->rawBatch == NULL || store->batchAcct == NULL || store->batchBalance == NULL) {
+        puts("Not enough memory to open the records.");
+        exit(-1);
+    }
+    // the journal sits next to credit.dat; without it the engine still runs
+    // (opened for update rather than append so commits can write at the
+    // LSN's own position, over any torn or old-format tail)
+    sidecarFileName(fileName, ".jnl", path, sizeof(path));
+    if ((store->journalPtr = fopen(path, "ab")) != NULL) {
+        fclose(store->journalPtr); // creates it if missing
+        store->journalPtr = fopen(path, "rb+");
+    }
+    store->checkpointInterval = intervalText != NULL ? strtoull(intervalText, NULL, 10)
+                                                     : DEFAULT_CHECKPOINT_INTERVAL;
+    store->durable = durableText != NULL && strcmp(durableText, "0") != 0;
+    // per-record checksums and the scrub thread; I7_SCRUB=0 turns the scrub off
+    pthread_mutex_init(&store->checksums.lock, NULL);
+    store->checksums.stride = stride;
+    store->checksums.shardIndex = shardIndex;
+    sidecarFileName(fileName, ".crc", path, sizeof(path));
+    store->checksums.fd = open(path, O_RDWR | O_CREAT, 0644);
+    versionOpen(store, fileName);
+    if (store->journalPtr != NULL) {
+        recoverStore(store); // before the scrub, which would flag unreplayed records
+    }
+    if (store->checksums.fd >= 0 && (scrubText == NULL || strcmp(scrubText, "0") != 0)) {
+        store->checksums.scrubRunning =
+            pthread_create(&store->checksums.scrubThread, NULL, scrubThread, store) == 0;
+    }
+
+    store->cacheSize = sizeText != NULL ? (size_t)strtoul(sizeText, NULL, 10) : DEFAULT_CACHE_SIZE;
+    store->cacheSize = (store->cacheSize + stride - 1) / stride;
+    if (store->cacheSize == 0) {
+        return;
+    }
+
+    while (bucketCount < store->cacheSize * 2) {
+        bucketCount *= 2;
+    }
+    store->entries = calloc(store->cacheSize, sizeof(struct cacheEntry));
+    store->buckets = malloc(bucketCount * sizeof(int));
+    store->dirtyList = malloc(store->cacheSize * sizeof(int));
+    if (store->entries == NULL || store->buckets == NULL || store->dirtyList == NULL) {
+        free(store->entries);
+        free(store->buckets);
+        free(store->dirtyList);
+        store->entries = NULL;
+        store->buckets = store->dirtyList = NULL;
+        store->cacheSize = 0; // run uncached rather than fail
+        return;
+    }
+    for (i = 0; i < bucketCount; i++) {
+        store->buckets[i] = -1;
+    }
+    store->bucketMask = bucketCount - 1;
+}
+
+// cache slot holding account, or -1 if it is not cached
+int cacheFind(struct recordStore *store, unsigned int account) {
+    int index = store->buckets[(account * 2654435761u) & store->bucketMask];
+
+    while (index != -1 && store->entries[index].account != account) {
+        index = store->entries[index].next;
+    }
+    return index;
+}
+
+// pick a slot to reuse with the CLOCK sweep. Dirty slots are never
+// evicted: a changed record reaches credit.dat only through commitShard.
+// If two turns of the hand find nothing but dirty slots, the changes
+// are committed early to free them.
+int cacheVictim(struct recordStore *store) {
+    size_t looked;
+
+    for (looked = 0;; looked++) {
+        struct cacheEntry *entry;
+        int index;
+
+        if (looked == 2 * store->cacheSize) {
+            // every slot is dirty
+            if (!commitShard(store)) {
+                puts("The journal could not be written.");
+                exit(-1);
+            }
+            store->forcedCommits++;
+        }
+        entry = &store->entries[store->clockHand];
+        index = (int)store->clockHand;
+        store->clockHand = (store->clockHand + 1) % store->cacheSize;
+        if (entry->account == 0) {
+            return index;
+        }
+        if (entry->dirty) {
+            continue; // written back at the next commit
+        }
+        if (entry->referenced) {
+            entry->referenced = 0; // second chance
+            continue;
+        }
+
+        // evict: unlink from its bucket
+        {
+            int *link = &store->buckets[(entry->account * 2654435761u) & store->bucketMask];
+            while (*link != index) {
+                link = &store->entries[*link].next;
+            }
+            *link = entry->next;
+        }
+        memset(entry, 0, sizeof(*entry));
+        store->evictions++;
+        return index;
+    }
+}
+
+// cache slot for account, loading it from the file on a miss
+int cacheLoad(struct recordStore *store, unsigned int account) {
+    int index = cacheFind(store, account);
+    size_t bucket;
+
+    if (index != -1) {
+        store->hits++;
+        store->entries[index].referenced = 1;
+        return index;
+    }
+
+    store->misses++;
+    index = cacheVictim(store);
+    fileReadRecord(store, account, &store->entries[index].record);
+    bucket = (account * 2654435761u) & store->bucketMask;
+    store->entries[index].account = account;
+    store->entries[index].referenced = 1;
+    store->entries[index].dirty = 0;
+    store->entries[index].next = store->buckets[bucket];
+    store->buckets[bucket] = index;
+    return index;
+}
+
+// read the record for account (blank record if it was never written)
+void readRecord(struct recordStore *store, unsigned int account, struct clientData *client) {
+    store = shardOf(store, account);
+    if (store->cacheSize == 0) {
+        size_t i = store->pendingCount;
+        while (i > 0 && store->pending[i - 1].account != account) {
+            i--;
+        }
+        if (i > 0) {
+            *client = store->pending[i - 1].record; // staged, not yet written
+        } else {
+            fileReadRecord(store, account, client);
+        }
+        return;
+    }
+    if (store->journalPtr != NULL) {
+        journalCatchUp(store);
+    }
+    *client = store->entries[cacheLoad(store, account)].record;
+}
+
+// replace the record for account; reaches the file at commitRecords
+void writeRecord(struct recordStore *store, unsigned int account, const struct clientData *client) {
+    struct clientData oldClient;
+    int index;
+
+    store = shardOf(store, account);
+    if (store->cacheSize == 0) {
+        // the record is written after its journal entry, at commit
+        readRecord(store, account, &oldClient);
+        if (!journalStage(store, account, &oldClient, client)) {
+            fileWriteRecord(store, account, client);
+        }
+        return;
+    }
+    index = cacheLoad(store, account);
+    journalStage(store, account, &store->entries[index].record, client);
+    store->entries[index].record = *client;
+    if (!store->entries[index].dirty) {
+        store->entries[index].dirty = 1;
+        store->dirtyList[store->dirtyCount++] = index;
+    }
+}
+
+// append the staged journal entries, then write every dirty cached record
+// (or, uncached, every staged record) back to the file. The journal lock
+// serialises commits from concurrent engine processes and hands out the
+// LSNs. With I7_DURABLE=1 the entries are synced to disk before any
+// record is written; every checkpointInterval entries a checkpoint is
+// taken. Returns 0 if the journal could not be written: then no record
+// is written, the journal is cut back to its last commit and the staged
+// entries and dirty records stay for the next commit to try again.
+int commitShard(struct recordStore *store) {
+    int locked = 0, repairsDue, ok = 1;
+    size_t count, i;
+
+    pthread_mutex_lock(&store->checksums.lock);
+    repairsDue = store->checksums.repairCount > 0 && store->journalPtr != NULL;
+    pthread_mutex_unlock(&store->checksums.lock);
+
+    if (store->pendingCount > 0 || repairsDue) {
+        {
+            TRACE_SPAN("journal lock wait", "lock");
+            locked = flock(fileno(store->journalPtr), LOCK_EX) == 0;
+        }
+        journalCatchUp(store);
+        if (repairsDue) {
+            repairRecords(store);
+        }
+    }
+    for (i = 0; i < store->pendingCount; i++) {
+        store->pending[i].lsn = store->journalLsn + i + 1;
+    }
+
+    // the records to write: the staged ones uncached, else the dirty ones
+    count = store->cacheSize == 0 ? store->pendingCount : store->dirtyCount;
+    if (count > store->writeCapacity) {
+        struct recordWrite *grown = realloc(store->writes, count * sizeof(struct recordWrite));
+        if (grown == NULL) {
+            puts("Not enough memory to commit the records.");
+            exit(-1);
+        }
+        store->writes = grown;
+        store->writeCapacity = count;
+    }
+    for (i = 0; i < count; i++) {
+        if (store->cacheSize == 0) {
+            store->writes[i].account = store->pending[i].account;
+            store->writes[i].record = &store->pending[i].record;
+        } else {
+            struct cacheEntry *entry = &store->entries[store->dirtyList[i]];
+            store->writes[i].account = entry->account;
+            store->writes[i].record = &entry->record;
+        }
+    }
+    if (store->pendingCount > 0 || count > 0) {
+        ok = store->io->commit(store, store->writes, count);
+    }
+    if (!ok) {
+        // drop whatever part of the entries reached the journal
+        ftruncate(fileno(store->journalPtr), (off_t)(store->journalLsn * sizeof(struct journalEntry)));
+    } else {
+        if (store->pendingCount > 0) {
+            store->journalLsn += store->pendingCount;
+            store->commits++;
+            store->committed += store->pendingCount;
+        }
+        if (store->cacheSize > 0) {
+            for (i = 0; i < count; i++) {
+                store->entries[store->dirtyList[i]].dirty = 0;
+            }
+            store->writeBacks += count;
+            store->dirtyCount = 0;
+        }
+        store->pendingCount = 0;
+    }
+    fflush(store->filePtr);
+
+    // a commit forced mid-group by a full cache leaves the group its lock
+    if (locked && !store->groupLocked) {
+        if (checkpointDue(store, store->journalLsn)) {
+            checkpointStore(store);
+        }
+        flock(fileno(store->journalPtr), LOCK_UN);
+    }
+    return ok;
+}
+
+// commit the changes of the operation just done; each shard commits
+// under its own journal lock. Returns 0 if any shard's journal could not
+// be written (see commitShard).
+int commitRecords(struct recordStore *store) {
+    size_t i;
+    int ok = 1;
+
+    for (i = 0; i < store->shardCount; i++) {
+        ok &= commitShard(&store->shards[i]);
+    }
+    return ok;
+}
+
+// release the columns of a snapshot
+void freeSnapshot(struct balanceSnapshot *snap) {
+    free(snap->acctNum);
+    free(snap->balance);
+    free(snap->nameOffset);
+    free(snap->names);
+    free(snap->position);
+}
+
+// commit outstanding changes of one shard (or an unsharded store) and
+// release its cache
+void closeShard(struct recordStore *store) {
+    if (store->checksums.scrubRunning) {
+        __atomic_store_n(&store->checksums.scrubStop, 1, __ATOMIC_RELEASE);
+        pthread_join(store->checksums.scrubThread, NULL);
+    }
+    if (!commitShard(store)) { // also repairs what the scrub found
+        fprintf(stderr, "i7: %s: the journal could not be written; changes were lost\n", store->fileName);
+    }
+#ifdef I7_URING
+    if (store->ring.fd >= 0) {
+        ringWait(&store->ring, 1); // the read-ahead may still be in flight
+        ringClose(&store->ring);
+    }
+#endif
+    free(store->writes);
+    if (store->checksums.crc != NULL) {
+        munmap(store->checksums.crc, store->checksums.slots * sizeof(unsigned int));
+    }
+    if (store->checksums.fd >= 0) {
+        close(store->checksums.fd);
+    }
+    if (store->versions != NULL) {
+        munmap(store->versions, VERSION_STRIPES * sizeof(unsigned long long));
+        close(store->versionFd);
+    }
+    pthread_mutex_destroy(&store->checksums.lock);
+    free(store->entries);
+    free(store->buckets);
+    free(store->dirtyList);
+    free(store->pending);
+    free(store->view.accounts);
+    free(store->view.images);
+    freeSnapshot(&store->snapshot);
+    free(store->rawBatch);
+    free(store->batchAcct);
+    free(store->batchBalance);
+    free(store->names.data);
+    free(store->names.table);
+    if (store->names.filePtr != NULL) {
+        fclose(store->names.filePtr);
+    }
+    if (store->journalPtr != NULL) {
+        fclose(store->journalPtr);
+    }
+    fclose(store->filePtr);
+}
+
+// commit outstanding changes and release the cache; the shards of a
+// sharded store are closed in parallel on their workers
+void closeStore(struct recordStore *store) {
+    size_t i;
+
+    if (store->shards == store) {
+        closeShard(store);
+        return;
+    }
+    shardRunAll(store, closeShard);
+    for (i = 0; i < store->shardCount; i++) {
+        struct shardWorker *worker = &store->shards[i].worker;
+
+        if (worker->running) {
+            pthread_mutex_lock(&worker->lock);
+            worker->stop = 1;
+            pthread_cond_signal(&worker->wake);
+            pthread_mutex_unlock(&worker->lock);
+            pthread_join(worker->thread, NULL);
+        }
+        pthread_mutex_destroy(&worker->lock);
+        pthread_cond_destroy(&worker->wake);
+        pthread_cond_destroy(&worker->done);
+        free(store->shards[i].shardBatch);
+    }
+    freeSnapshot(&store->snapshot);
+    free(store->shards);
+    free(store->batchAcct);
+    free(store->batchBalance);
+}
+
+// Open the store fileName as the count shard files next to it
+// (credit.s0.dat, credit.s1.dat, ...); account a lives in shard
+// (a - 1) % count. Each shard is opened (and recovered) as a store of
+// its own and gets a worker thread for scans. Returns 0 if a shard
+// could not be opened.
+int openShards(struct recordStore *store, const char *fileName, size_t count) {
+    char path[512];
+    size_t i;
+
+    memset(store, 0, sizeof(*store));
+    snprintf(store->fileName, sizeof(store->fileName), "%s", fileName);
+    store->stride = 1;
+    store->shards = calloc(count, sizeof(struct recordStore));
+    store->batchAcct = malloc(SCAN_BATCH * sizeof(unsigned int));
+    store->batchBalance = malloc(SCAN_BATCH * sizeof(long long));
+    if (store->shards == NULL || store->batchAcct == NULL || store->batchBalance == NULL) {
+        puts("Not enough memory to open the records.");
+        exit(-1);
+    }
+    for (i = 0; i < count; i++) {
+        struct recordStore *shard = &store->shards[i];
+        FILE *fPtr;
+
+        shardFileName(fileName, i, path, sizeof(path));
+        if ((fPtr = fopen(path, "rb+")) == NULL) {
+            break;
+        }
+        openStore(shard, fPtr, path, i, count);
+        if ((shard->shardBatch = malloc(SCAN_BATCH * sizeof(struct clientData))) == NULL) {
+            puts("Not enough memory to open the records.");
+            exit(-1);
+        }
+        pthread_mutex_init(&shard->worker.lock, NULL);
+        pthread_cond_init(&shard->worker.wake, NULL);
+        pthread_cond_init(&shard->worker.done, NULL);
+        shard->worker.running = pthread_create(&shard->worker.thread, NULL, shardWorkerThread, shard) == 0;
+        store->shardCount = i + 1;
+    }
+    if (store->shardCount < count) {
+        closeStore(store);
+        return 0;
+    }
+    store->version = store->shards[0].version;
+    store->recordSize = store->shards[0].recordSize;
+    return 1;
+}
+
+// shard count of the store fileName, recorded next to it in credit.shards;
+// 0 if the store is not sharded
+size_t readShardCount(const char *fileName) {
+    char path[512];
+    FILE *countPtr;
+    unsigned long count = 0;
+
+    sidecarFileName(fileName, ".shards", path, sizeof(path));
+    if ((countPtr = fopen(path, "r")) != NULL) {
+        if (fscanf(countPtr, "%lu", &count) != 1) {
+            count = 0;
+        }
+        fclose(countPtr);
+    }
+    return count;
+}
+
+// Split the unsharded store fileName into count shard files of the same
+// format, then record the count in credit.shards, which switches engines
+// over to the shards. The shards and their sidecars are made afresh;
+// fileName is left as it was and can be removed once the shards are in
+// use. Records that fail their checksums are repaired from the journal
+// and copied again; if that cannot fix them the split is abandoned, as
+// the shards would give the bad bytes new checksums. Engines must not be
+// running, since they keep the old file open.
+// Returns the number of records copied, or -1.
+long splitStore(const char *fileName, size_t count) {
+    static const char *const sidecars[] = {".names", ".jnl", ".crc", ".ckpt"};
+    struct recordStore source, *shards = NULL;
+    struct clientData *batch = malloc(SCAN_BATCH * sizeof(struct clientData));
+    char path[512], temp[520];
+    FILE *fPtr = fopen(fileName, "rb+"), *countPtr;
+    unsigned long long errors;
+    long copied = 0;
+    size_t opened, slot, got, i;
+    int ok = 0, pass;
+
+    if (fPtr == NULL || batch == NULL || count < 2 || count > MAX_SHARDS || readShardCount(fileName) > 1 ||
+        (shards = calloc(count, sizeof(struct recordStore))) == NULL) {
+        if (fPtr != NULL) {
+            fclose(fPtr);
+        }
+        free(batch);
+        return -1;
+    }
+    openStore(&source, fPtr, fileName, 0, 1);
+
+    for (opened = 0; opened < count; opened++) {
+        FILE *shardPtr;
+
+        shardFileName(fileName, opened, path, sizeof(path));
+        for (i = 0; i < sizeof(sidecars) / sizeof(sidecars[0]); i++) {
+            sidecarFileName(path, sidecars[i], temp, sizeof(temp));
+            remove(temp);
+        }
+        if ((shardPtr = fopen(path, "wb+")) == NULL) {
+            break;
+        }
+        if (source.version == FILE_VERSION) {
+            struct fileHeader header;
+
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+            header.version = FILE_VERSION;
+            header.recordSize = sizeof(struct packedRecord);
+            header.flags = FILE_FLAG_CENTS;
+            fwrite(&header, sizeof(header), 1, shardPtr);
+            fflush(shardPtr);
+        }
+        openStore(&shards[opened], shardPtr, path, opened, count);
+    }
+
+    // records go over as the engine reads them, unvalidated, so the
+    // shards hold exactly what the file did
+    for (pass = 0; pass < 2 && opened == count && !ok; pass++) {
+        errors = source.checksums.errors;
+        copied = 0;
+        slot = 0;
+        rewindRecords(&source);
+        while ((got = readRecords(&source, batch, SCAN_BATCH)) > 0) {
+            for (i = 0; i < got; i++, slot++) {
+                if (batch[i].acctNum != 0) {
+                    fileWriteRecord(&shards[slot % count], (unsigned int)slot + 1, &batch[i]);
+                    copied++;
+                }
+            }
+        }
+        ok = source.checksums.errors == errors;
+        commitRecords(&source); // repairs the records that failed
+    }
+    for (i = 0; i < opened; i++) {
+        closeStore(&shards[i]); // also checkpoints each shard
+    }
+    closeStore(&source);
+    free(shards);
+    free(batch);
+    if (!ok) {
+        return -1;
+    }
+
+    sidecarFileName(fileName, ".shards", path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    if ((countPtr = fopen(temp, "w")) == NULL) {
+        return -1;
+    }
+    ok = fprintf(countPtr, "%zu\n", count) > 0 && fflush(countPtr) == 0 && fsync(fileno(countPtr)) == 0;
+    fclose(countPtr);
+    if (!ok || rename(temp, path) != 0) {
+        remove(temp);
+        return -1;
+    }
+    return copied;
+}
+
+// Whether str is terminated within maxLength bytes and every byte before
+// the terminator is printable ASCII (what isprint accepts in the C
+// locale). Checks 32 (AVX2) or 16 (SSE2) bytes per step; a signed compare
+// also rejects bytes >= 0x80, which read as negative.
+int nameIsClean(const char *str, int maxLength) {
+    int i = 0;
+
+#ifdef __AVX2__
+    for (; i + 32 <= maxLength; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(str + i));
+        unsigned int zero = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_setzero_si256()));
+        unsigned int bad = (unsigned int)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), bytes),
+                            _mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(0x7E)))) & ~zero;
+        if (zero != 0) {
+            return (bad & ((zero & (0U - zero)) - 1)) == 0; // bad bytes before the first zero
+        }
+        if (bad != 0) {
+            return 0;
+        }
+    }
+#endif
+#ifdef __SSE2__
+    for (; i + 16 <= maxLength; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(str + i));
+        unsigned int zero = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_setzero_si128()));
+        unsigned int bad = (unsigned int)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmplt_epi8(bytes, _mm_set1_epi8(0x20)),
+                         _mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x7E)))) & ~zero;
+        if (zero != 0) {
+            return (bad & ((zero & (0U - zero)) - 1)) == 0;
+        }
+        if (bad != 0) {
+            return 0;
+        }
+    }
+#endif
+    for (; i < maxLength; i++) {
+        if (str[i] == '\0') {
+            return 1;
+        }
+        if (str[i] < 0x20 || str[i] > 0x7E) {
+            return 0;
+        }
+    }
+    return 0; // not terminated
+}
+
+// Function to clean up and sanitize names (strip out non-printable characters).
+// str must have room for maxLength bytes; the result always fits in them.
+void sanitizeString(char *str, int maxLength) {
+    int i, j = 0;
+
+    if (nameIsClean(str, maxLength)) {
+        return; // the usual case: nothing to strip
+    }
+    {
+        TRACE_SPAN("sanitizeString", "format");
+        for (i = 0; i < maxLength - 1 && str[i] != '\0'; i++) {
+            if (isprint((unsigned char)str[i])) {
+                str[j++] = str[i];
+            }
+        }
+        str[j] = '\0'; // Null terminate the cleaned string
+    }
+}
+
+#define MIN_VALID_BALANCE -100000000LL // V6 lower bound, in cents
+#define MAX_VALID_BALANCE 1000000000LL // V6 upper bound, in cents
+
+// V6 validation: the record sits in its own slot and has a reasonable balance
+int isValidRecord(const struct clientData *client, size_t slot) {
+    return client->acctNum >= 1 && client->acctNum == slot + 1 &&
+           client->balance >= MIN_VALID_BALANCE && client->balance <= MAX_VALID_BALANCE;
+}
+
+// V6 validation of a whole block of records given as account and balance
+// columns: bit i of bits is set when record i (in slot firstSlot + i) is
+// valid. With SSE4.2 four records are compared per step.
+void validateBlock(const unsigned int *acctNum, const long long *balance, size_t firstSlot, size_t count,
+                   unsigned long long *bits) {
+    size_t i = 0;
+
+    memset(bits, 0, (count + 63) / 64 * sizeof(*bits));
+#ifdef __SSE4_2__
+    {
+        const __m128i low = _mm_set1_epi64x(MIN_VALID_BALANCE - 1);
+        const __m128i high = _mm_set1_epi64x(MAX_VALID_BALANCE + 1);
+        for (; i + 4 <= count; i += 4) {
+            __m128i expected = _mm_add_epi32(_mm_set1_epi32((int)(firstSlot + i + 1)), _mm_setr_epi32(0, 1, 2, 3));
+            __m128i acctOk = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(acctNum + i)), expected);
+            __m128i first = _mm_loadu_si128((const __m128i *)(balance + i));
+            __m128i second = _mm_loadu_si128((const __m128i *)(balance + i + 2));
+            __m128i firstOk = _mm_and_si128(_mm_cmpgt_epi64(first, low), _mm_cmpgt_epi64(high, first));
+            __m128i secondOk = _mm_and_si128(_mm_cmpgt_epi64(second, low), _mm_cmpgt_epi64(high, second));
+            // one 32-bit lane per record, then one bit per record
+            __m128 balanceOk = _mm_shuffle_ps(_mm_castsi128_ps(firstOk), _mm_castsi128_ps(secondOk),
+                                              _MM_SHUFFLE(2, 0, 2, 0));
+            unsigned int mask = (unsigned int)_mm_movemask_ps(_mm_and_ps(_mm_castsi128_ps(acctOk), balanceOk));
+            bits[i / 64] |= (unsigned long long)mask << (i % 64);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        unsigned long long ok = acctNum[i] != 0 && acctNum[i] == firstSlot + i + 1 &&
+                                balance[i] >= MIN_VALID_BALANCE && balance[i] <= MAX_VALID_BALANCE;
+        bits[i / 64] |= ok << (i % 64);
+    }
+}
+
+// make sure the slot -> column map covers slot; returns 0 if out of memory
+int snapshotReserveSlot(struct balanceSnapshot *snap, size_t slot) {
+    size_t newCount = snap->slotCount ? snap->slotCount : 128;
+    int *grown;
+
+    if (slot < snap->slotCount) {
+        return 1;
+    }
+    while (newCount <= slot) {
+        newCount *= 2;
+    }
+    if ((grown = realloc(snap->position, newCount * sizeof(int))) == NULL) {
+        return 0;
+    }
+    memset(grown + snap->slotCount, -1, (newCount - snap->slotCount) * sizeof(int));
+    snap->position = grown;
+    snap->slotCount = newCount;
+    return 1;
+}
+
+// store the sanitized names of client and return their offset
+unsigned int snapshotAddNames(struct balanceSnapshot *snap, const struct clientData *client) {
+    char lastName[LAST_NAME_SIZE], firstName[FIRST_NAME_SIZE];
+    size_t lastLength, firstLength, offset = snap->namesUsed;
+
+    memcpy(lastName, client->lastName, sizeof(lastName));
+    memcpy(firstName, client->firstName, sizeof(firstName));
+    lastName[sizeof(lastName) - 1] = firstName[sizeof(firstName) - 1] = '\0';
+    sanitizeString(lastName, sizeof(lastName));
+    sanitizeString(firstName, sizeof(firstName));
+    lastLength = strlen(lastName) + 1;
+    firstLength = strlen(firstName) + 1;
+
+    if (snap->namesUsed + lastLength + firstLength > snap->namesCapacity) {
+        size_t newCapacity = snap->namesCapacity ? snap->namesCapacity * 2 : 4096;
+        char *grown;
+        while (snap->namesUsed + lastLength + firstLength > newCapacity) {
+            newCapacity *= 2;
+        }
+        if ((grown = realloc(snap->names, newCapacity)) == NULL) {
+            return 0; // offset 0 still points at a valid (if wrong) name
+        }
+        snap->names = grown;
+        snap->namesCapacity = newCapacity;
+    }
+    memcpy(snap->names + offset, lastName, lastLength);
+    memcpy(snap->names + offset + lastLength, firstName, firstLength);
+    snap->namesUsed += lastLength + firstLength;
+    return (unsigned int)offset;
+}
+
+// put the record for slot into the columns, or take it out if it is not valid
+void snapshotApply(struct balanceSnapshot *snap, size_t slot, const struct clientData *client, int namesChanged) {
+    int index;
+
+    if (!snapshotReserveSlot(snap, slot)) {
+        return;
+    }
+    index = snap->position[slot];
+
+    if (!isValidRecord(client, slot)) {
+        if (index != -1) { // move the last account into the hole
+            size_t last = snap->count - 1;
+            snap->acctNum[index] = snap->acctNum[last];
+            snap->balance[index] = snap->balance[last];
+            snap->nameOffset[index] = snap->nameOffset[last];
+            snap->position[snap->acctNum[index] - 1] = index;
+            snap->position[slot] = -1;
+            snap->count--;
+        }
+        return;
+    }
+
+    if (index == -1) {
+        if (snap->count == snap->capacity) {
+            size_t newCapacity = snap->capacity ? snap->capacity * 2 : 256;
+            unsigned int *acctNum = realloc(snap->acctNum, newCapacity * sizeof(unsigned int));
+            long long *balance = acctNum ? realloc(snap->balance, newCapacity * sizeof(long long)) : NULL;
+            unsigned int *nameOffset = balance ? realloc(snap->nameOffset, newCapacity * sizeof(unsigned int)) : NULL;
+            if (acctNum != NULL) snap->acctNum = acctNum;
+            if (balance != NULL) snap->balance = balance;
+            if (nameOffset == NULL) {
+                return;
+            }
+            snap->nameOffset = nameOffset;
+            snap->capacity = newCapacity;
+        }
+        index = (int)snap->count++;
+        snap->position[slot] = index;
+        namesChanged = 1;
+    }
+    snap->acctNum[index] = client->acctNum;
+    snap->balance[index] = client->balance;
+    if (namesChanged) {
+        snap->nameOffset[index] = snapshotAddNames(snap, client);
+    }
+}
+
+// bring the columnar snapshot up to date: a full scan of credit.dat the
+// first time, afterwards only the journal entries committed since
+struct balanceSnapshot *refreshSnapshot(struct recordStore *store) {
+    struct balanceSnapshot *snap = &store->snapshot;
+    struct journalEntry entry;
+    size_t s;
+
+    for (s = 0; s < store->shardCount; s++) {
+        if (store->shards[s].journalPtr == NULL) {
+            snap->built = 0; // nothing to replay, so rescan every time
+        }
+    }
+
+    if (!snap->built) {
+        struct clientData *batch = malloc(SCAN_BATCH * sizeof(struct clientData));
+        size_t slot = 0, got, i;
+        TRACE_SPAN("build snapshot", "read");
+
+        if (batch == NULL) {
+            return snap;
+        }
+        snap->count = 0;
+        snap->namesUsed = 0;
+        if (snap->position != NULL) {
+            memset(snap->position, -1, snap->slotCount * sizeof(int));
+        }
+        rewindRecords(store);
+        while ((got = readRecords(store, batch, SCAN_BATCH)) > 0) {
+            for (i = 0; i < got; i++, slot++) {
+                if (batch[i].acctNum != 0) {
+                    snapshotApply(snap, slot, &batch[i], 1);
+                }
+            }
+        }
+        free(batch);
+        snap->built = 1;
+        // the scan saw the store as of its view; later entries are
+        // replayed next time
+        for (s = 0; s < store->shardCount; s++) {
+            store->shards[s].snapshotLsn = store->shards[s].view.lsn;
+        }
+        return snap;
+    }
+
+    {
+        TRACE_SPAN("replay journal into snapshot", "journal");
+        for (s = 0; s < store->shardCount; s++) {
+            struct recordStore *shard = &store->shards[s];
+            unsigned long long end = journalEnd(shard);
+
+            // an entry still being written (its LSN not yet in place) is
+            // picked up next time, as in viewCatchUp
+            for (; shard->snapshotLsn < end && journalRead(shard, shard->snapshotLsn + 1, &entry) &&
+                   entry.lsn == shard->snapshotLsn + 1;
+                 shard->snapshotLsn++) {
+                snapshotApply(snap, entry.account - 1, &entry.record, entry.op == JOURNAL_NEW);
+            }
+        }
+    }
+    return snap;
+}
+
+// copy account out of the snapshot's columns; returns 0 if it is not there
+int snapshotRecord(const struct balanceSnapshot *snap, unsigned int account, struct clientData *client) {
+    const char *names;
+    int index;
+
+    if (account == 0 || account > snap->slotCount || (index = snap->position[account - 1]) == -1) {
+        return 0;
+    }
+    names = snap->names + snap->nameOffset[index];
+    client->acctNum = snap->acctNum[index];
+    client->balance = snap->balance[index];
+    strncpy(client->lastName, names, sizeof(client->lastName) - 1);
+    client->lastName[sizeof(client->lastName) - 1] = '\0';
+    strncpy(client->firstName, names + strlen(names) + 1, sizeof(client->firstName) - 1);
+    client->firstName[sizeof(client->firstName) - 1] = '\0';
+    return 1;
+}
+
+// Sort entries carry only an order-preserving 64-bit key and the record
+// slot, never the whole record. Keys already encode the sort direction,
+// so sorting is a radix sort on key; only name entries, whose key is a
+// prefix, carry the full names to break ties.
+struct sortEntry {
+    unsigned long long key; // order-preserving sort key
+    unsigned int slot;      // record slot in credit.dat
+}; // end structure sortEntry
+
+struct nameEntry {
+    struct sortEntry head; // key = first 8 bytes of the last name
+    char lastName[LAST_NAME_SIZE];   // sanitized, compared when keys tie
+    char firstName[FIRST_NAME_SIZE]; // sanitized, compared when last names tie
+}; // end structure nameEntry
+
+// How to build and order the entries of one sort
+struct sortSpec {
+    size_t entrySize;
+    int (*compare)(const void *a, const void *b); // full order, for merging and ties
+    void (*makeEntry)(const struct sortSpec *spec, const struct clientData *client, unsigned int slot, void *entry);
+    int keyIsPrefix;            // equal keys may still need compare
+    unsigned long long keyFlip; // ~0 for descending order: every key is inverted
+}; // end structure sortSpec
+
+// One sorted run being merged: a spilled temporary file or a sorted
+// stretch of the in-memory buffer
+struct sortRun {
+    FILE *filePtr;      // run file (NULL for an in-memory run)
+    const char *memory; // next entry of an in-memory run
+    size_t remaining;   // entries not yet consumed
+    char *current;      // entry at the head of the run
+}; // end structure sortRun
+
+// Work for one thread sorting a segment of the run buffer
+struct sortSegment {
+    char *base;
+    char *scratch; // same-sized space for the radix passes
+    size_t count;
+    const struct sortSpec *spec;
+}; // end structure sortSegment
+
+#define DEFAULT_SORT_MEMORY (64u << 20) // run buffer when I7_SORT_MEMORY is unset
+#define PARALLEL_SORT_MIN 65536         // entries before runs are sorted in parallel
+#define SORT_IO_BUFFER (1u << 20)       // stdio buffer per run file
+#define TOP_K_HEAP_MAX 65536            // largest offset + limit kept in a heap
+#define SORT_FAILED ((size_t)-1)        // sortRecords: the sort was abandoned
+
+// State of one sorted page: which rows to keep and what has been printed
+struct sortPage {
+    struct recordStore *store;
+    const struct sortSpec *spec;
+    size_t offset;   // rows to skip
+    size_t limit;    // rows to print
+    size_t seen;     // rows emitted so far (external sort path)
+    char *entries;   // heap or collected entries
+    size_t count;    // entries held
+    size_t capacity; // entries that fit
+}; // end structure sortPage
+
+// Function to compare two accounts by balance (for low-to-high or high-to-low,
+// which the key already encodes); equal balances go in slot order
+int compareByBalance(const void *a, const void *b) {
+    const struct sortEntry *accountA = a;
+    const struct sortEntry *accountB = b;
+
+    if (accountA->key != accountB->key) {
+        return accountA->key > accountB->key ? 1 : -1;
+    }
+    return (accountA->slot > accountB->slot) - (accountA->slot < accountB->slot);
+}
+
+// Function to compare two accounts by name, in direction (1 alphabetical,
+// -1 reverse); equal names go in slot order
+int compareNames(const struct nameEntry *accountA, const struct nameEntry *accountB, int direction) {
+    int cmpLast;
+
+    if (accountA->head.key != accountB->head.key) {
+        return accountA->head.key > accountB->head.key ? 1 : -1;
+    }
+
+    cmpLast = strcmp(accountA->lastName, accountB->lastName);
+    
+    if (cmpLast == 0) {
+        cmpLast = strcmp(accountA->firstName, accountB->firstName);
+    }
+    if (cmpLast == 0) {
+        return (accountA->head.slot > accountB->head.slot) - (accountA->head.slot < accountB->head.slot);
+    }
+    
+    return direction * cmpLast;
+}
+
+// Function to compare two accounts by name (alphabetical order)
+int compareByName(const void *a, const void *b) {
+    return compareNames(a, b, 1);
+}
+
+// Function to compare two accounts by name (reverse alphabetical order)
+int compareByNameDescending(const void *a, const void *b) {
+    return compareNames(a, b, -1);
+}
+
+// Map a balance in cents to an unsigned key with the same order by
+// flipping the sign bit
+unsigned long long balanceKey(long long balance) {
+    return (unsigned long long)balance ^ 0x8000000000000000ULL;
+}
+
+// First 8 bytes of a sanitized name, big-endian, so that integer order
+// matches strcmp order on the prefix
+unsigned long long namePrefixKey(const char *name) {
+    unsigned long long key = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        key = (key << 8) | (unsigned char)(*name ? *name++ : 0);
+    }
+    return key;
+}
+
+void makeBalanceEntry(const struct sortSpec *spec, const struct clientData *client, unsigned int slot, void *entry) {
+    struct sortEntry *sortEntry = entry;
+
+    sortEntry->slot = slot;
+    sortEntry->key = balanceKey(client->balance) ^ spec->keyFlip;
+}
+
+void makeNameEntry(const struct sortSpec *spec, const struct clientData *client, unsigned int slot, void *entry) {
+    struct nameEntry *nameEntry = entry;
+
+    nameEntry->head.slot = slot;
+    memcpy(nameEntry->lastName, client->lastName, sizeof(nameEntry->lastName));
+    memcpy(nameEntry->firstName, client->firstName, sizeof(nameEntry->firstName));
+    // names from the store are already sanitized and terminated
+    nameEntry->head.key = namePrefixKey(nameEntry->lastName) ^ spec->keyFlip;
+}
+
+const struct sortSpec balanceSort = {sizeof(struct sortEntry), compareByBalance, makeBalanceEntry, 0, 0};
+const struct sortSpec balanceSortDescending = {sizeof(struct sortEntry), compareByBalance, makeBalanceEntry, 0, ~0ULL};
+const struct sortSpec nameSort = {sizeof(struct nameEntry), compareByName, makeNameEntry, 1, 0};
+const struct sortSpec nameSortDescending = {sizeof(struct nameEntry), compareByNameDescending, makeNameEntry, 1, ~0ULL};
+
+// the sort for criterion (1 balance, 2 name) in the given order
+const struct sortSpec *sortSpecFor(int criterion, int ascending) {
+    if (criterion == 1) {
+        return ascending ? &balanceSort : &balanceSortDescending;
+    }
+    return ascending ? &nameSort : &nameSortDescending;
+}
+
+// LSD radix sort of count entries on their 64-bit key, one byte per pass.
+// All eight byte histograms are built in a single read of the entries, and
+// passes in which every key has the same byte are skipped.
+void radixSortEntries(char *base, char *scratch, size_t count, size_t entrySize) {
+    static __thread size_t histogram[8][256];
+    char *from = base, *to = scratch, *swap;
+    size_t i;
+    int pass;
+
+    memset(histogram, 0, sizeof(histogram));
+    for (i = 0; i < count; i++) {
+        unsigned long long key = ((const struct sortEntry *)(base + i * entrySize))->key;
+        for (pass = 0; pass < 8; pass++) {
+            histogram[pass][(key >> (8 * pass)) & 0xFF]++;
+        }
+    }
+
+    for (pass = 0; pass < 8; pass++) {
+        size_t *counts = histogram[pass];
+        size_t offset = 0;
+        unsigned long long firstKey = ((const struct sortEntry *)from)->key;
+        int digit;
+
+        if (counts[(firstKey >> (8 * pass)) & 0xFF] == count) {
+            continue; // every key shares this byte
+        }
+        for (digit = 0; digit < 256; digit++) { // bucket starts
+            size_t bucketCount = counts[digit];
+            counts[digit] = offset;
+            offset += bucketCount;
+        }
+        for (i = 0; i < count; i++) {
+            const char *entry = from + i * entrySize;
+            unsigned long long key = ((const struct sortEntry *)entry)->key;
+            memcpy(to + counts[(key >> (8 * pass)) & 0xFF]++ * entrySize, entry, entrySize);
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != base) {
+        memcpy(base, from, count * entrySize);
+    }
+}
+
+// radix sort one segment, then order runs of equal prefix keys by name
+void sortSegment(struct sortSegment *segment) {
+    const struct sortSpec *spec = segment->spec;
+    size_t begin, end;
+
+    if (segment->count < 2) {
+        return;
+    }
+    radixSortEntries(segment->base, segment->scratch, segment->count, spec->entrySize);
+    if (!spec->keyIsPrefix) {
+        return;
+    }
+
+    for (begin = 0; begin < segment->count; begin = end) {
+        unsigned long long key = ((const struct sortEntry *)(segment->base + begin * spec->entrySize))->key;
+        for (end = begin + 1; end < segment->count &&
+             ((const struct sortEntry *)(segment->base + end * spec->entrySize))->key == key; end++) {
+        }
+        if (end - begin > 1) {
+            qsort(segment->base + begin * spec->entrySize, end - begin, spec->entrySize, spec->compare);
+        }
+    }
+}
+
+// task pool range: sort segments [begin, end)
+void sortSegmentRange(void *context, size_t begin, size_t end) {
+    struct sortSegment *segments = context;
+
+    for (; begin < end; begin++) {
+        sortSegment(&segments[begin]);
+    }
+}
+
+// sort count entries as one segment per pool thread (at most
+// MAX_SCAN_THREADS); returns the number of sorted segments, which the
+// caller merges
+int sortBuffer(char *buffer, char *scratch, size_t count, const struct sortSpec *spec,
+               struct sortSegment *segments) {
+    int segmentCount = count >= PARALLEL_SORT_MIN ? taskWorkers() : 1, i;
+    TRACE_SPAN("sort run", "sort");
+
+    for (i = 0; i < segmentCount; i++) {
+        size_t begin = count * i / segmentCount, end = count * (i + 1) / segmentCount;
+        segments[i].base = buffer + begin * spec->entrySize;
+        segments[i].scratch = scratch + begin * spec->entrySize;
+        segments[i].count = end - begin;
+        segments[i].spec = spec;
+    }
+    taskRun(sortSegmentRange, segments, 0, (size_t)segmentCount, 1);
+    return segmentCount;
+}
+
+// load the next entry of run into run->current; returns 0 when exhausted
+int sortRunAdvance(struct sortRun *run, size_t entrySize) {
+    if (run->remaining == 0) {
+        return 0;
+    }
+    run->remaining--;
+    if (run->filePtr != NULL) {
+        return fread(run->current, entrySize, 1, run->filePtr) == 1;
+    }
+    memcpy(run->current, run->memory, entrySize);
+    run->memory += entrySize;
+    return 1;
+}
+
+// restore the min-heap of run indices below position
+void sortHeapDown(int *heap, int heapSize, int position, struct sortRun *runs, const struct sortSpec *spec) {
+    for (;;) {
+        int smallest = position, left = 2 * position + 1, right = left + 1;
+        if (left < heapSize && spec->compare(runs[heap[left]].current, runs[heap[smallest]].current) < 0) {
+            smallest = left;
+        }
+        if (right < heapSize && spec->compare(runs[heap[right]].current, runs[heap[smallest]].current) < 0) {
+            smallest = right;
+        }
+        if (smallest == position) {
+            return;
+        }
+        int temp = heap[position];
+        heap[position] = heap[smallest];
+        heap[smallest] = temp;
+        position = smallest;
+    }
+}
+
+// k-way merge of sorted runs, handing each slot to emit in order; returns
+// 0 if there was no memory to start it
+int mergeRuns(struct sortRun *runs, int runCount, const struct sortSpec *spec,
+               void (*emit)(unsigned int slot, void *context), void *context) {
+    int *heap = malloc(runCount * sizeof(int));
+    char *heads = malloc(runCount * spec->entrySize);
+    int heapSize = 0, i;
+    TRACE_SPAN("merge runs", "sort");
+
+    if (heap == NULL || heads == NULL) {
+        free(heap);
+        free(heads);
+        puts("Not enough memory to merge the sorted runs.");
+        return 0;
+    }
+    for (i = 0; i < runCount; i++) {
+        runs[i].current = heads + i * spec->entrySize;
+        if (sortRunAdvance(&runs[i], spec->entrySize)) {
+            heap[heapSize++] = i;
+        }
+    }
+    for (i = heapSize / 2 - 1; i >= 0; i--) {
+        sortHeapDown(heap, heapSize, i, runs, spec);
+    }
+
+    while (heapSize > 0) {
+        struct sortRun *run = &runs[heap[0]];
+        emit(((const struct sortEntry *)run->current)->slot, context);
+        if (!sortRunAdvance(run, spec->entrySize)) {
+            heap[0] = heap[--heapSize];
+        }
+        sortHeapDown(heap, heapSize, 0, runs, spec);
+    }
+    free(heap);
+    free(heads);
+    return 1;
+}
+
+// sort the full buffer and append its segments to runs as run files;
+// returns 0 if a run could not be made, after saying why
+int spillRuns(char *buffer, size_t capacity, size_t used, const struct sortSpec *spec,
+              struct sortRun **runs, int *runCount) {
+    struct sortSegment segments[MAX_SCAN_THREADS];
+    struct sortRun *grown = realloc(*runs, (*runCount + MAX_SCAN_THREADS) * sizeof(struct sortRun));
+    int segmentCount, s;
+
+    if (grown == NULL) {
+        puts("Not enough memory to sort.");
+        return 0;
+    }
+    *runs = grown;
+    segmentCount = sortBuffer(buffer, buffer + capacity * spec->entrySize, used, spec, segments);
+    for (s = 0; s < segmentCount; s++) {
+        FILE *runPtr = tmpfile();
+        if (runPtr == NULL || fwrite(segments[s].base, spec->entrySize, segments[s].count, runPtr) != segments[s].count ||
+            fflush(runPtr) != 0) {
+            if (runPtr != NULL) {
+                fclose(runPtr);
+            }
+            puts("Not enough temporary file space to sort.");
+            return 0;
+        }
+        rewind(runPtr);
+        grown[*runCount].filePtr = runPtr;
+        grown[*runCount].memory = NULL;
+        grown[*runCount].remaining = segments[s].count;
+        (*runCount)++;
+    }
+    return 1;
+}
+
+// Sort engine: stream every valid record of credit.dat through
+// (key, slot) entries and emit the slots in order. Entries are gathered
+// in a buffer of I7_SORT_MEMORY bytes (half of it radix scratch space);
+// a full buffer is sorted in parallel segments and spilled as run files,
+// and the runs are then k-way merged with large sequential reads. Books
+// that fit in the buffer never touch a temporary file. Returns the
+// number of entries sorted, or SORT_FAILED (with nothing emitted, once a
+// run cannot be kept) if memory or temporary file space runs out.
+size_t sortRecords(struct recordStore *store, const struct sortSpec *spec,
+                   void (*emit)(unsigned int slot, void *context), void *context) {
+    const char *memoryText = getenv("I7_SORT_MEMORY");
+    size_t budget = memoryText != NULL ? (size_t)strtoull(memoryText, NULL, 10) : DEFAULT_SORT_MEMORY;
+    size_t capacity, used = 0, total = 0, got, slot = 0, i;
+    struct sortSegment segments[MAX_SCAN_THREADS];
+    struct sortRun *runs = NULL;
+    int runCount = 0, segmentCount, s, failed = 0;
+    struct clientData *batch = malloc(SCAN_BATCH * sizeof(struct clientData));
+    char *buffer;
+
+    capacity = budget / (2 * spec->entrySize);
+    if (capacity < SCAN_BATCH) {
+        capacity = SCAN_BATCH;
+    }
+    buffer = malloc(2 * capacity * spec->entrySize);
+    if (batch == NULL || buffer == NULL) {
+        free(batch);
+        free(buffer);
+        puts("Not enough memory to sort.");
+        return SORT_FAILED;
+    }
+
+    // run generation: one sequential pass over the record file
+    {
+        TRACE_SPAN("generate runs", "sort");
+        rewindRecords(store);
+        while (!failed && (got = readRecords(store, batch, SCAN_BATCH)) > 0) {
+            for (i = 0; i < got; i++, slot++) {
+                if (!recordValid(store, i)) {
+                    continue;
+                }
+                if (used == capacity) { // spill the full buffer as sorted runs
+                    if (!spillRuns(buffer, capacity, used, spec, &runs, &runCount)) {
+                        failed = 1;
+                        break;
+                    }
+                    used = 0;
+                }
+                spec->makeEntry(spec, &batch[i], (unsigned int)slot, buffer + used * spec->entrySize);
+                used++;
+                total++;
+            }
+        }
+    }
+    free(batch);
+
+    // the last (or only) buffer is merged straight from memory
+    if (!failed) {
+        struct sortRun *grown = realloc(runs, (runCount + MAX_SCAN_THREADS) * sizeof(struct sortRun));
+        if (grown == NULL) {
+            puts("Not enough memory to sort.");
+            failed = 1;
+        } else {
+            runs = grown;
+            segmentCount = used > 0 ? sortBuffer(buffer, buffer + capacity * spec->entrySize, used, spec, segments) : 0;
+            for (s = 0; s < segmentCount; s++) {
+                runs[runCount].filePtr = NULL;
+                runs[runCount].memory = segments[s].base;
+                runs[runCount].remaining = segments[s].count;
+                runCount++;
+            }
+            // give the run files large sequential reads
+            for (s = 0; s < runCount; s++) {
+                if (runs[s].filePtr != NULL) {
+                    setvbuf(runs[s].filePtr, NULL, _IOFBF, SORT_IO_BUFFER);
+                }
+            }
+            failed = !mergeRuns(runs, runCount, spec, emit, context);
+        }
+    }
+
+    for (s = 0; s < runCount; s++) {
+        if (runs[s].filePtr != NULL) {
+            fclose(runs[s].filePtr);
+        }
+    }
+    free(runs);
+    free(buffer);
+    return failed ? SORT_FAILED : total;
+}
+
+// Function to handle the sort option (after user selects '5' for sorting)
+void sortOption(struct recordStore *store) {
+    int criterion, ascending;
+
+    // Ask the user for the sorting criterion
+    printf("\nChoose sorting criterion:\n");
+    printf("1 - Sort by Balance\n");
+    printf("2 - Sort by Last Name and First Name\n");
+    printf("3 - Show Account with Maximum Balance\n");
+    printf("4 - Show Account with Minimum Balance\n");
+    printf("Enter your choice: ");
+    {
+        TRACE_SPAN("parse criterion", "parse");
+        scanf("%d", &criterion);
+    }
+
+    if (criterion == 3 || criterion == 4) {
+        // For min/max options, we don't need sorting order
+        sortAccounts(store, criterion, 1);
+        return;
+    }
+
+    // Ask the user for ascending or descending order (only for sorting options 1 & 2)
+    printf("\nChoose sorting order:\n");
+    printf("1 - Ascending\n");
+    printf("2 - Descending\n");
+    printf("Enter your choice: ");
+    {
+        TRACE_SPAN("parse order", "parse");
+        scanf("%d", &ascending);
+    }
+
+    // Convert input to 0 or 1 for ascending or descending
+    ascending = (ascending == 1) ? 1 : 0;
+
+    // Call sortAccounts with the selected criterion and order
+    sortAccounts(store, criterion, ascending);
+}
+
+// Main function
+int main(int argc, char *argv[])
+{
+    FILE *cfPtr;               // credit.dat file pointer
+    struct recordStore store;  // credit.dat with its record cache
+    size_t shardCount;         // shard files of a sharded store
+    unsigned int choice;       // user's choice
+
+    // i7 --migrate-cents [file...] converts old double balances to cents;
+    // i7 --migrate-v2 [file...] rewrites files in the packed version 2 layout
+    if (argc > 1 && (strcmp(argv[1], "--migrate-cents") == 0 || strcmp(argv[1], "--migrate-v2") == 0))
+    {
+        int toVersion2 = strcmp(argv[1], "--migrate-v2") == 0;
+        int i;
+        for (i = 2; i < argc || i == 2; i++)
+        {
+            const char *fileName = i < argc ? argv[i] : "credit.dat";
+            long converted = toVersion2 ? migrateVersion2(fileName) : migrateCents(fileName);
+            if (converted < 0)
+            {
+                printf("%s: %s could not be migrated.\n", argv[0], fileName);
+                exit(-1);
+            }
+            printf("%s: %ld records converted to %s\n", fileName, converted, toVersion2 ? "version 2" : "cents");
+        }
+        return 0;
+    }
+
+    // i7 --shard N [file] splits the store into N shard files
+    if (argc > 2 && strcmp(argv[1], "--shard") == 0)
+    {
+        const char *fileName = argc > 3 ? argv[3] : "credit.dat";
+        long copied = splitStore(fileName, (size_t)strtoul(argv[2], NULL, 10));
+        if (copied < 0)
+        {
+            printf("%s: %s could not be split into %s shards.\n", argv[0], fileName, argv[2]);
+            exit(-1);
+        }
+        printf("%s: %ld records split into %s shards\n", fileName, copied, argv[2]);
+        return 0;
+    }
+
+    // I7_MAX_ACCOUNT caps the account numbers the menu and --serve accept
+    loadAccountLimit();
+
+    // a sharded store (credit.shards names the shard count) is opened
+    // from its shard files instead of credit.dat
+    shardCount = readShardCount("credit.dat");
+    if (shardCount > 1)
+    {
+        if (shardCount > MAX_SHARDS || !openShards(&store, "credit.dat", shardCount))
+        {
+            printf("%s: File could not be opened.\n", argv[0]);
+            exit(-1);
+        }
+    }
+    // fopen opens the file; exits if file cannot be opened
+    else if ((cfPtr = fopen("credit.dat", "rb+")) == NULL)
+    {
+        printf("%s: File could not be opened.\n", argv[0]);
+        exit(-1);
+    }
+    else
+    {
+        openStore(&store, cfPtr, "credit.dat", 0, 1);
+    }
+
+    // i7 --serve <socket path or port> answers the line protocol instead
+    // of the menu; i7 --replica <address> answers its reads only (see serve)
+    if (argc > 2 && (strcmp(argv[1], "--serve") == 0 || strcmp(argv[1], "--replica") == 0))
+    {
+        if (!serve(&store, argv[2], strcmp(argv[1], "--replica") == 0))
+        {
+            printf("%s: cannot listen on %s.\n", argv[0], argv[2]);
+            closeStore(&store);
+            exit(-1);
+        }
+        closeStore(&store); // writes back the cache and closes the file
+        taskPoolStop();
+        return 0;
+    }
+
+    // i7 --ship <standby address> streams this store's journal to a
+    // standby; i7 --standby <address> applies a primary's journal (see
+    // shipJournal and standby)
+    if (argc > 2 && (strcmp(argv[1], "--ship") == 0 || strcmp(argv[1], "--standby") == 0))
+    {
+        int ok = strcmp(argv[1], "--ship") == 0 ? shipJournal(&store, argv[2]) : standby(&store, argv[2]);
+        closeStore(&store);
+        taskPoolStop();
+        if (!ok)
+        {
+            printf("%s: cannot replicate through %s.\n", argv[0], argv[2]);
+            exit(-1);
+        }
+        return 0;
+    }
+
+    // i7 --feed <address> streams committed changes to subscribers (see feed)
+    if (argc > 2 && strcmp(argv[1], "--feed") == 0)
+    {
+        int ok = feed(&store, argv[2]);
+        closeStore(&store);
+        taskPoolStop();
+        if (!ok)
+        {
+            printf("%s: cannot publish changes on %s.\n", argv[0], argv[2]);
+            exit(-1);
+        }
+        return 0;
+    }
+
+    // enable user to specify action
+    while ((choice = enterChoice()) != 6)  // CHANGED: from 5 to 6
+    {
+        switch (choice)
+        {
+        case 1:  // create text file from record file
+        {
+            TRACE_SPAN("textFile", "request");
+            textFile(&store);
+            break;
+        }
+        case 2:  // update record
+        {
+            TRACE_SPAN("updateRecord", "request");
+            updateRecord(&store);
+            break;
+        }
+        case 3:  // create record
+        {
+            TRACE_SPAN("newRecord", "request");
+            newRecord(&store);
+            break;
+        }
+        case 4:  // delete existing record
+        {
+            TRACE_SPAN("deleteRecord", "request");
+            deleteRecord(&store);
+            break;
+        }
+        case 5:  // sort accounts by balance or other criteria
+        {
+            TRACE_SPAN("sortOption", "request");
+            sortOption(&store);  // Handle sort option
+            break;
+        }
+        case 7:  // show cache and engine statistics
+            showStatistics(&store);
+            break;
+        case 8:  // totals, percentiles and histogram of balances
+        {
+            TRACE_SPAN("aggregateOption", "request");
+            aggregateOption(&store);
+            break;
+        }
+        case 9:  // one page of a sorted listing
+        {
+            TRACE_SPAN("sortPageOption", "request");
+            sortPageOption(&store);
+            break;
+        }
+        default:
+            puts("Incorrect choice");
+            break;
+        }
+    }
+
+    closeStore(&store); // writes back the cache and closes the file
+    taskPoolStop();
+} // end main
+
+// enable user to input menu choice
+unsigned int enterChoice(void)
+{
+    unsigned int menuChoice; // variable to store user's choice
+    // display available options
+    printf("%s", "\nEnter your choice\n"
+                 "1 - store a formatted text file of accounts called\n"
+                 "    \"accounts.txt\" for printing\n"
+                 "2 - update an account\n"
+                 "3 - add a new account\n"
+                 "4 - delete an account\n"
+                 "5 - sort accounts by balance or other criteria\n"  // NEW: Sort option
+                 "6 - end program\n"               // CHANGED: from 5 to 6
+                 "7 - show engine statistics\n"     // NEW: cache statistics
+                 "8 - aggregate balances\n"         // NEW: totals and histogram
+                 "9 - show one page of a sorted listing\n? "); // NEW: top-k/paging
+
+    {
+        int matched;
+        TRACE_SPAN("enterChoice", "parse");
+        matched = scanf("%u", &menuChoice); // receive choice from user
+        if (matched == EOF) {
+            menuChoice = 6; // input closed: end the program rather than spin
+        } else if (matched != 1) {
+            scanf("%*[^\n]"); // skip what is not a number
+            menuChoice = 0;
+        }
+    }
+    return menuChoice;
+} // end function enterChoice
+
+// create formatted text file for printing
+void textFile(struct recordStore *store)
+{
+    FILE *writePtr; // accounts.txt file pointer
+    size_t result;  // records read by the last readRecords
+    size_t i;
+    // records of one batch of the scan
+    struct clientData *batch = malloc(SCAN_BATCH * sizeof(struct clientData));
+    // their lines, formatted on the task pool
+    struct exportBatch lines = {batch, malloc(SCAN_BATCH * EXPORT_LINE), malloc(SCAN_BATCH * sizeof(int))};
+
+    // fopen opens the file; exits if file cannot be opened
+    if (batch == NULL || lines.text == NULL || lines.lengths == NULL ||
+        (writePtr = fopen("accounts.txt", "w")) == NULL)
+    {
+        puts("File could not be opened.");
+    } // end if
+    else
+    {
+        rewindRecords(store); // sets pointer to beginning of file
+        fprintf(writePtr, "%-6s%-16s%-11s%10s\n", "Acct", "Last Name", "First Name", "Balance");
+
+        // copy all records from random-access file into text file, a
+        // batch at a time, as of the moment the export started
+        do
+        {
+            {
+                TRACE_SPAN("read records", "read");
+                result = readRecords(store, batch, SCAN_BATCH);
+            }
+
+            // write each record of the batch to text file
+            TRACE_SPAN("format records", "format");
+            taskRun(exportRange, &lines, 0, result, EXPORT_GRAIN);
+            for (i = 0; i < result; i++)
+            {
+                fwrite(lines.text + i * EXPORT_LINE, 1, (size_t)lines.lengths[i], writePtr);
+            } // end for
+        } while (result != 0); // end do...while
+
+        fclose(writePtr); // fclose closes the file
+    }                     // end else
+    free(lines.text);
+    free(lines.lengths);
+    free(batch);
+} // end function textFile
+
+// task pool range: format the accounts.txt lines of batch records
+// [begin, end); blank slots get an empty line
+void exportRange(void *context, size_t begin, size_t end) {
+    struct exportBatch *lines = context;
+    char amount[24];
+
+    for (; begin < end; begin++) {
+        const struct clientData *client = &lines->batch[begin];
+        int length = 0;
+
+        if (client->acctNum != 0) {
+            // names come out of readRecords already sanitized
+            length = snprintf(lines->text + begin * EXPORT_LINE, EXPORT_LINE, "%-5u %-15s %-10s %10s\n",
+                              client->acctNum, client->lastName, client->firstName,
+                              formatCents(client->balance, amount));
+        }
+        lines->lengths[begin] = length < 0 ? 0 : length >= EXPORT_LINE ? EXPORT_LINE - 1 : length;
+    }
+}
+
+// update balance in record
+void updateRecord(struct recordStore *store)
+{
+    unsigned int account;   // account number
+    long long transaction;  // transaction amount in cents
+    char amountText[32];    // transaction amount as typed
+    char amount[24];        // formatted balance
+    // create clientData with no information
+    struct clientData client = {0, "", "", 0};
+
+    // obtain number of account to update
+    printf("Enter account to update ( 1 - %u ): ", maxAccount);
+    {
+        TRACE_SPAN("parse account", "parse");
+        if (scanf("%u", &account) != 1 || !accountInRange(account)) {
+            printf("Account numbers run from 1 to %u.\n", maxAccount);
+            return;
+        }
+    }
+
+    // read record (from the cache when the account is hot)
+    readRecord(store, account, &client);
+    // display error if account does not exist
+    if (client.acctNum == 0)
+    {
+        printf("Account #%d has no information.\n", account);
+    }
+    else
+    { // update record
+        printf("%-5u %-15s %-10s %10s\n\n", client.acctNum, client.lastName, client.firstName,
+               formatCents(client.balance, amount));
+
+        // request transaction amount from user
+        printf("%s", "Enter charge ( + ) or payment ( - ): ");
+        {
+            TRACE_SPAN("parse amount", "parse");
+            if (scanf("%31s", amountText) != 1 || !parseCents(amountText, &transaction)) {
+                printf("Invalid amount.\n");
+                return;
+            }
+        }
+        // update record balance (exact, in cents)
+        if (__builtin_add_overflow(client.balance, transaction, &client.balance)) {
+            printf("Balance would overflow.\n");
+            return;
+        }
+
+        printf("%-5u %-15s %-10s %10s\n", client.acctNum, client.lastName, client.firstName,
+               formatCents(client.balance, amount));
+
+        // write updated record over old record and commit it to the file
+        writeRecord(store, account, &client);
+        if (!commitRecords(store)) {
+            puts("The journal could not be written; the change is kept for the next commit.");
+        }
+    } // end else
+} // end function updateRecord
+
+// delete an existing record
+void deleteRecord(struct recordStore *store)
+{
+    struct clientData client;                       // stores record read from file
+    struct clientData blankClient;                  // blank client
+    unsigned int accountNum;                        // account number
+
+    // obtain number of account to delete
+    printf("Enter account number to delete ( 1 - %u ): ", maxAccount);
+    {
+        TRACE_SPAN("parse account", "parse");
+        if (scanf("%u", &accountNum) != 1 || !accountInRange(accountNum)) {
+            printf("Account numbers run from 1 to %u.\n", maxAccount);
+            return;
+        }
+    }
+
+    // read record (from the cache when the account is hot)
+    readRecord(store, accountNum, &client);
+    // display error if record does not exist
+    if (client.acctNum == 0)
+    {
+        printf("Account %d does not exist.\n", accountNum);
+    } // end if
+    else
+    { // delete record
+        // replace existing record with blank record; it keeps the names
+        // so the journal entry can give the record back to snapshot readers
+        blankClient = client;
+        blankClient.acctNum = 0;
+        blankClient.balance = 0;
+        writeRecord(store, accountNum, &blankClient);
+        if (!commitRecords(store)) {
+            puts("The journal could not be written; the change is kept for the next commit.");
+        }
+    } // end else
+} // end function deleteRecord
+
+// create and insert record
+void newRecord(struct recordStore *store)
+{
+    // create clientData with default information
+    struct clientData client = {0, "", "", 0};
+    unsigned int accountNum; // account number
+    char balanceText[32];    // opening balance as typed
+
+    // obtain number of account to create
+    printf("Enter new account number ( 1 - %u ): ", maxAccount);
+    {
+        TRACE_SPAN("parse account", "parse");
+        if (scanf("%u", &accountNum) != 1 || !accountInRange(accountNum)) {
+            printf("Account numbers run from 1 to %u.\n", maxAccount);
+            return;
+        }
+    }
+
+    // read record (from the cache when the account is hot)
+    readRecord(store, accountNum, &client);
+    // display error if account already exists
+    if (client.acctNum != 0)
+    {
+        printf("Account #%d already contains information.\n", client.acctNum);
+    } // end if
+    else
+    { // create record
+        // user enters last name, first name and balance
+        printf("%s", "Enter lastname, firstname, balance\n? ");
+        {
+            TRACE_SPAN("parse record", "parse");
+            // widths are LAST_NAME_SIZE - 1 and FIRST_NAME_SIZE - 1
+            if (scanf("%31s%23s%31s", client.lastName, client.firstName, balanceText) != 3 ||
+                !parseCents(balanceText, &client.balance)) {
+                printf("Invalid balance.\n");
+                return;
+            }
+        }
+
+        // sanitize once on the way in, so stored names are always clean
+        sanitizeString(client.lastName, sizeof(client.lastName));
+        sanitizeString(client.firstName, sizeof(client.firstName));
+        client.acctNum = accountNum;
+        // insert record and commit it to the file
+        writeRecord(store, accountNum, &client);
+        if (!commitRecords(store)) {
+            puts("The journal could not be written; the change is kept for the next commit.");
+        }
+    } // end else
+} // end function newRecord
+
+// Show the account with the maximum (or minimum) balance from the snapshot
+void showExtremeBalance(struct recordStore *store, int maximum) {
+    struct balanceSnapshot *snap = refreshSnapshot(store);
+    const long long *balance = snap->balance;
+    size_t best = 0, i;
+    char amount[24];
+
+    if (snap->count == 0) {
+        printf("No accounts found.\n");
+        return;
+    }
+
+    {
+        TRACE_SPAN("scan balance column", "sort");
+        for (i = 1; i < snap->count; i++) {
+            if (maximum ? balance[i] > balance[best] : balance[i] < balance[best]) {
+                best = i;
+            }
+        }
+    }
+
+    printf("\n%-6s%-16s%-11s%-15s\n", "Acct", "Last Name", "First Name", "Balance");
+    printf("====================================================\n");
+    printf("Account with %s balance:\n", maximum ? "MAXIMUM" : "MINIMUM");
+    printf("%-5u %-15s %-10s %-15s\n", snap->acctNum[best], snap->names + snap->nameOffset[best],
+           snap->names + snap->nameOffset[best] + strlen(snap->names + snap->nameOffset[best]) + 1,
+           formatCents(balance[best], amount));
+} // end function showExtremeBalance
+
+// scan one chunk of the balance column, keeping count/sum/min/max of the
+// matching accounts and copying their balances out for the percentiles
+void aggregateScan(struct aggregateChunk *chunk) {
+    const struct aggregateQuery *query = chunk->query;
+    const struct balanceSnapshot *snap = chunk->snap;
+    const long long *balance = snap->balance;
+    long long *out = chunk->matched + chunk->begin;
+    long long lo = query->minBalance, hi = query->maxBalance;
+    long long sum = 0, min = LLONG_MAX, max = LLONG_MIN;
+    size_t n = 0, i;
+
+    if (query->prefixLength == 0) {
+        // balance-only: branch-free body the compiler can vectorise
+        for (i = chunk->begin; i < chunk->end; i++) {
+            long long value = balance[i];
+            int keep = (value >= lo) & (value <= hi);
+            out[n] = value;
+            n += keep;
+            sum += keep ? value : 0;
+            min = keep && value < min ? value : min;
+            max = keep && value > max ? value : max;
+        }
+    } else {
+        for (i = chunk->begin; i < chunk->end; i++) {
+            long long value = balance[i];
+            if (value >= lo && value <= hi &&
+                strncmp(snap->names + snap->nameOffset[i], query->prefix, query->prefixLength) == 0) {
+                out[n++] = value;
+                sum += value;
+                min = value < min ? value : min;
+                max = value > max ? value : max;
+            }
+        }
+    }
+
+    chunk->count = n;
+    chunk->sum = sum;
+    chunk->min = min;
+    chunk->max = max;
+}
+
+// task pool range: scan chunks [begin, end)
+void aggregateRange(void *context, size_t begin, size_t end) {
+    struct aggregateChunk *chunks = context;
+
+    for (; begin < end; begin++) {
+        aggregateScan(&chunks[begin]);
+    }
+}
+
+// k-th smallest of values[0..n-1] (quickselect; reorders values)
+long long selectNth(long long *values, size_t n, size_t k) {
+    size_t left = 0, right = n - 1;
+
+    while (left < right) {
+        long long pivot = values[left + (right - left) / 2];
+        size_t i = left, j = right;
+        while (i <= j) {
+            while (values[i] < pivot) i++;
+            while (values[j] > pivot) j--;
+            if (i <= j) {
+                long long temp = values[i];
+                values[i] = values[j];
+                values[j] = temp;
+                i++;
+                if (j == 0) break;
+                j--;
+            }
+        }
+        if (k <= j) right = j;
+        else if (k >= i) left = i;
+        else break;
+    }
+    return values[k];
+}
+
+// Sum, count, mean, min, max, percentiles and a histogram of the balances
+// matching query, all from one pass over the snapshot's balance column.
+// Large books are split into chunks scanned on the task pool.
+void aggregateBalances(struct recordStore *store, const struct aggregateQuery *query, int buckets) {
+    struct balanceSnapshot *snap = refreshSnapshot(store);
+    struct aggregateChunk chunks[AGGREGATE_CHUNKS];
+    size_t histogram[MAX_BUCKETS] = {0};
+    size_t count = 0, i;
+    long long sum = 0, min = LLONG_MAX, max = LLONG_MIN, span, mean;
+    long long *matched;
+    char amount[24], upper[24];
+    int chunkCount = 1, c;
+    const int percentiles[] = {50, 90, 99};
+
+    if ((matched = malloc((snap->count ? snap->count : 1) * sizeof(long long))) == NULL) {
+        puts("Not enough memory for the aggregate.");
+        return;
+    }
+
+    if (snap->count >= PARALLEL_SCAN_MIN) {
+        chunkCount = AGGREGATE_CHUNKS;
+    }
+
+    {
+        TRACE_SPAN("aggregate scan", "sort");
+        for (c = 0; c < chunkCount; c++) {
+            chunks[c].snap = snap;
+            chunks[c].query = query;
+            chunks[c].begin = snap->count * c / chunkCount;
+            chunks[c].end = snap->count * (c + 1) / chunkCount;
+            chunks[c].matched = matched;
+        }
+        taskRun(aggregateRange, chunks, 0, (size_t)chunkCount, 1);
+
+        // merge the partial results, packing the matches together
+        for (c = 0; c < chunkCount; c++) {
+            memmove(matched + count, matched + chunks[c].begin, chunks[c].count * sizeof(long long));
+            count += chunks[c].count;
+            sum += chunks[c].sum;
+            min = chunks[c].min < min ? chunks[c].min : min;
+            max = chunks[c].max > max ? chunks[c].max : max;
+        }
+    }
+
+    printf("\n%-12s%zu\n", "count:", count);
+    printf("%-12s%s\n", "sum:", formatCents(sum, amount));
+    if (count == 0) {
+        free(matched);
+        return;
+    }
+    // mean rounded half away from zero to whole cents
+    mean = sum / (long long)count;
+    if (2 * llabs(sum % (long long)count) >= (long long)count) {
+        mean += sum < 0 ? -1 : 1;
+    }
+    printf("%-12s%s\n", "mean:", formatCents(mean, amount));
+    printf("%-12s%s\n", "min:", formatCents(min, amount));
+    printf("%-12s%s\n", "max:", formatCents(max, amount));
+
+    // histogram over [min, max] in equal-width buckets
+    span = max - min;
+    for (i = 0; i < count; i++) {
+        long long bucket = span > 0 ? (matched[i] - min) * buckets / span : 0;
+        histogram[bucket < buckets ? bucket : buckets - 1]++;
+    }
+
+    for (c = 0; c < (int)(sizeof(percentiles) / sizeof(percentiles[0])); c++) {
+        size_t rank = (percentiles[c] * count + 99) / 100; // nearest rank
+        char label[8];
+        snprintf(label, sizeof(label), "p%d:", percentiles[c]);
+        printf("%-12s%s\n", label, formatCents(selectNth(matched, count, rank > 0 ? rank - 1 : 0), amount));
+    }
+
+    for (c = 0; c < buckets; c++) {
+        printf("%-12s%s %s %zu\n", "bucket:", formatCents(min + span * c / buckets, amount),
+               formatCents(c + 1 == buckets ? max : min + span * (c + 1) / buckets, upper), histogram[c]);
+    }
+    free(matched);
+} // end function aggregateBalances
+
+// Ask for the aggregate filters (* = no filter) and run the query
+void aggregateOption(struct recordStore *store) {
+    struct aggregateQuery query;
+    char low[32], high[32], prefix[32];
+    int buckets;
+
+    printf("%s", "Enter minimum balance, maximum balance, last name prefix and histogram buckets\n"
+                 "(* for no limit or any name)\n? ");
+    {
+        TRACE_SPAN("parse aggregate query", "parse");
+        if (scanf("%31s%31s%31s%d", low, high, prefix, &buckets) != 4) {
+            puts("Invalid aggregate query");
+            return;
+        }
+    }
+
+    query.minBalance = LLONG_MIN;
+    query.maxBalance = LLONG_MAX;
+    if ((strcmp(low, "*") != 0 && !parseCents(low, &query.minBalance)) ||
+        (strcmp(high, "*") != 0 && !parseCents(high, &query.maxBalance))) {
+        puts("Invalid aggregate query");
+        return;
+    }
+    if (strcmp(prefix, "*") == 0) {
+        prefix[0] = '\0';
+    }
+    strncpy(query.prefix, prefix, sizeof(query.prefix) - 1);
+    query.prefix[sizeof(query.prefix) - 1] = '\0';
+    query.prefixLength = strlen(query.prefix);
+    buckets = buckets < 1 ? 1 : buckets > MAX_BUCKETS ? MAX_BUCKETS : buckets;
+
+    aggregateBalances(store, &query, buckets);
+} // end function aggregateOption
+
+// Print one row of a sorted listing, reading the record by slot
+void printSortedAccount(unsigned int slot, void *context) {
+    struct recordStore *store = context;
+    struct clientData client;
+    char amount[24];
+
+    viewReadRecord(store, slot + 1, &client);
+    printf("%-5u %-15s %-10s %-15s\n", client.acctNum, client.lastName, client.firstName,
+           formatCents(client.balance, amount));
+}
+
+// Enhanced sortAccounts function with all features
+void sortAccounts(struct recordStore *store, int criterion, int ascending) {
+    const struct sortSpec *spec;
+
+    // Max/min only need the balance column, so scan the snapshot
+    if (criterion == 3 || criterion == 4) {
+        showExtremeBalance(store, criterion == 3);
+        return;
+    }
+
+    // Pick the sort key based on the criterion
+    switch (criterion) {
+        case 1:  // Sort by Balance
+        case 2:  // Sort by Last Name and First Name
+            spec = sortSpecFor(criterion, ascending);
+            break;
+        default:
+            printf("Invalid sorting criterion!\n");
+            return;
+    }
+
+    // Print sorted accounts with proper alignment (only for cases 1 and 2);
+    // rows are streamed out of the sort engine as the merge produces them
+    printf("\n%-6s%-16s%-11s%-15s\n", "Acct", "Last Name", "First Name", "Balance");
+    printf("====================================================\n");
+    if (sortRecords(store, spec, printSortedAccount, store) == 0) {
+        printf("No accounts found.\n");
+    }
+}
+
+// Print one ranked row of a sorted page
+void printPageRow(struct sortPage *page, size_t rank, unsigned int slot) {
+    struct clientData client;
+    char amount[24];
+
+    viewReadRecord(page->store, slot + 1, &client);
+    printf("%-5zu %-5u %-15s %-10s %-15s\n", rank, client.acctNum, client.lastName, client.firstName,
+           formatCents(client.balance, amount));
+}
+
+// Call take for the entry of every valid record, in file order; returns
+// how many there were
+size_t scanSortEntries(struct recordStore *store, const struct sortSpec *spec,
+                       void (*take)(const void *entry, void *context), void *context) {
+    struct clientData *batch = malloc(SCAN_BATCH * sizeof(struct clientData));
+    struct nameEntry entry; // large enough for either entry type
+    size_t got, slot = 0, total = 0, i;
+    TRACE_SPAN("scan sort keys", "read");
+
+    if (batch == NULL) {
+        return 0;
+    }
+    rewindRecords(store);
+    while ((got = readRecords(store, batch, SCAN_BATCH)) > 0) {
+        for (i = 0; i < got; i++, slot++) {
+            if (recordValid(store, i)) {
+                spec->makeEntry(spec, &batch[i], (unsigned int)slot, &entry);
+                take(&entry, context);
+                total++;
+            }
+        }
+    }
+    free(batch);
+    return total;
+}
+
+// keep the offset + limit smallest entries in a max-heap
+void pageHeapTake(const void *entry, void *context) {
+    struct sortPage *page = context;
+    size_t size = page->spec->entrySize, position, child;
+    char *heap = page->entries;
+    char temp[sizeof(struct nameEntry)];
+
+    if (page->count < page->capacity) { // sift the new entry up
+        position = page->count++;
+        memcpy(heap + position * size, entry, size);
+        while (position > 0) {
+            size_t parent = (position - 1) / 2;
+            if (page->spec->compare(heap + parent * size, heap + position * size) >= 0) {
+                break;
+            }
+            memcpy(temp, heap + parent * size, size);
+            memcpy(heap + parent * size, heap + position * size, size);
+            memcpy(heap + position * size, temp, size);
+            position = parent;
+        }
+        return;
+    }
+    if (page->spec->compare(entry, heap) >= 0) {
+        return; // not among the smallest
+    }
+
+    memcpy(heap, entry, size); // replace the largest and sift down
+    for (position = 0; (child = 2 * position + 1) < page->count; position = child) {
+        if (child + 1 < page->count &&
+            page->spec->compare(heap + (child + 1) * size, heap + child * size) > 0) {
+            child++;
+        }
+        if (page->spec->compare(heap + child * size, heap + position * size) <= 0) {
+            break;
+        }
+        memcpy(temp, heap + child * size, size);
+        memcpy(heap + child * size, heap + position * size, size);
+        memcpy(heap + position * size, temp, size);
+    }
+}
+
+// collect every entry for the partial-sort path
+void pageCollectTake(const void *entry, void *context) {
+    struct sortPage *page = context;
+
+    if (page->count < page->capacity) {
+        memcpy(page->entries + page->count * page->spec->entrySize, entry, page->spec->entrySize);
+    }
+    page->count++; // counts past capacity so the caller can tell
+}
+
+// reorder entries so the k-th smallest is at k with smaller ones before
+// it (nth_element)
+void selectEntries(char *entries, size_t count, size_t k, const struct sortSpec *spec) {
+    size_t size = spec->entrySize, left = 0, right = count - 1;
+    char pivot[sizeof(struct nameEntry)], temp[sizeof(struct nameEntry)];
+
+    while (left < right) {
+        size_t i = left, j = right;
+        memcpy(pivot, entries + (left + (right - left) / 2) * size, size);
+        while (i <= j) {
+            while (spec->compare(entries + i * size, pivot) < 0) i++;
+            while (spec->compare(entries + j * size, pivot) > 0) j--;
+            if (i <= j) {
+                memcpy(temp, entries + i * size, size);
+                memcpy(entries + i * size, entries + j * size, size);
+                memcpy(entries + j * size, temp, size);
+                i++;
+                if (j == 0) break;
+                j--;
+            }
+        }
+        if (k <= j) right = j;
+        else if (k >= i) left = i;
+        else break;
+    }
+}
+
+// print only the rows of the page from the external sort
+void pageSkipEmit(unsigned int slot, void *context) {
+    struct sortPage *page = context;
+
+    if (page->seen >= page->offset && page->seen < page->offset + page->limit) {
+        printPageRow(page, page->seen + 1, slot);
+    }
+    page->seen++;
+}
+
+// Print rows offset+1 .. offset+limit of a sorted listing without sorting
+// the whole book when it can be avoided: a bounded heap for small pages
+// (O(N log K)), nth_element plus a sort of just the page when every key
+// fits in I7_SORT_MEMORY, and the external sort otherwise.
+void sortPage(struct recordStore *store, const struct sortSpec *spec, size_t offset, size_t limit) {
+    const char *memoryText = getenv("I7_SORT_MEMORY");
+    size_t budget = memoryText != NULL ? (size_t)strtoull(memoryText, NULL, 10) : DEFAULT_SORT_MEMORY;
+    struct sortPage page = {store, spec, offset, limit, 0, NULL, 0, 0};
+    size_t wanted = offset + limit, total, i;
+    TRACE_SPAN("sorted page", "sort");
+
+    if (limit == 0 || wanted < offset) {
+        printf("Invalid page!\n");
+        return;
+    }
+
+    if (wanted <= TOP_K_HEAP_MAX) {
+        page.capacity = wanted;
+        page.entries = malloc(wanted * spec->entrySize);
+        if (page.entries == NULL) {
+            puts("Not enough memory for the page.");
+            return;
+        }
+        total = scanSortEntries(store, spec, pageHeapTake, &page);
+        qsort(page.entries, page.count, spec->entrySize, spec->compare);
+    } else {
+        page.capacity = budget / spec->entrySize;
+        page.entries = malloc((page.capacity ? page.capacity : 1) * spec->entrySize);
+        if (page.entries == NULL) {
+            puts("Not enough memory for the page.");
+            return;
+        }
+        total = scanSortEntries(store, spec, pageCollectTake, &page);
+        if (page.count > page.capacity) { // too big for memory: full external sort
+            free(page.entries);
+            printf("\n%-7s%zu %zu %zu\n", "page:", offset, limit, total);
+            printf("%-6s%-6s%-16s%-11s%-15s\n", "Rank", "Acct", "Last Name", "First Name", "Balance");
+            printf("==========================================================\n");
+            sortRecords(store, spec, pageSkipEmit, &page);
+            return;
+        }
+        if (wanted > page.count) {
+            wanted = page.count;
+        }
+        if (offset < wanted) {
+            selectEntries(page.entries, page.count, wanted - 1, spec);
+            selectEntries(page.entries, wanted, offset, spec);
+            qsort(page.entries + offset * spec->entrySize, wanted - offset, spec->entrySize, spec->compare);
+        }
+        page.count = wanted;
+    }
+
+    printf("\n%-7s%zu %zu %zu\n", "page:", offset, limit, total);
+    printf("%-6s%-6s%-16s%-11s%-15s\n", "Rank", "Acct", "Last Name", "First Name", "Balance");
+    printf("==========================================================\n");
+    for (i = offset; i < page.count; i++) {
+        printPageRow(&page, i + 1, ((const struct sortEntry *)(page.entries + i * spec->entrySize))->slot);
+    }
+    free(page.entries);
+} // end function sortPage
+
+// Ask for criterion, order, offset and limit, then print that page
+void sortPageOption(struct recordStore *store) {
+    int criterion, ascending;
+    unsigned long offset, limit;
+
+    printf("%s", "Enter criterion (1 - balance, 2 - name), order (1 - ascending, 2 - descending),\n"
+                 "offset and limit\n? ");
+    {
+        TRACE_SPAN("parse page request", "parse");
+        if (scanf("%d%d%lu%lu", &criterion, &ascending, &offset, &limit) != 4) {
+            puts("Invalid page request");
+            return;
+        }
+    }
+    if (criterion != 1 && criterion != 2) {
+        printf("Invalid sorting criterion!\n");
+        return;
+    }
+
+    sortPage(store, sortSpecFor(criterion, ascending == 1), offset, limit);
+} // end function sortPageOption
+
+// print cache statistics as "name: value" lines; counters of a sharded
+// store are summed over its shards (LSNs too, as each shard numbers its
+// own journal)
+void showStatistics(struct recordStore *store)
+{
+    unsigned long long cacheSize = 0, hits = 0, misses = 0, evictions = 0, writeBacks = 0, forced = 0;
+    unsigned long long errors = 0, repairs = 0, scrubbed = 0, checkpointLsn = 0, journalTail = 0;
+    unsigned long long checkpoints = 0, replayed = 0, viewLsn = 0, viewUndone = 0, readRetries = 0;
+    unsigned long long commits = 0, committed = 0;
+#ifdef I7_URING
+    unsigned long long ringSubmits = 0, ringOperations = 0;
+#endif
+    size_t i;
+
+    for (i = 0; i < store->shardCount; i++) {
+        struct recordStore *shard = &store->shards[i];
+
+        cacheSize += shard->cacheSize;
+        hits += shard->hits;
+        misses += shard->misses;
+        evictions += shard->evictions;
+        writeBacks += shard->writeBacks;
+        forced += shard->forcedCommits;
+        pthread_mutex_lock(&shard->checksums.lock);
+        errors += shard->checksums.errors;
+        repairs += shard->checksums.repairs;
+        scrubbed += shard->checksums.scrubbed;
+        pthread_mutex_unlock(&shard->checksums.lock);
+        checkpointLsn += shard->checkpointLsn;
+        journalTail += shard->journalLsn - shard->checkpointLsn;
+        checkpoints += shard->checkpoints;
+        replayed += shard->replayed;
+        commits += shard->commits;
+        committed += shard->committed;
+        viewLsn += shard->view.lsn;
+        viewUndone += shard->view.undone;
+        readRetries += __atomic_load_n(&shard->readRetries, __ATOMIC_RELAXED);
+#ifdef I7_URING
+        ringSubmits += shard->ring.submits;
+        ringOperations += shard->ring.operations;
+#endif
+    }
+
+    printf("\n%-18s%u\n", "file_version:", store->version);
+    printf("%-18s%llu\n", "record_size:", (unsigned long long)store->recordSize);
+    printf("%-18s%llu\n", "shards:", (unsigned long long)store->shardCount);
+    printf("%-18s%s\n", "io_backend:", store->shards[0].io->name);
+#ifdef I7_URING
+    printf("%-18s%llu\n", "io_submits:", ringSubmits);
+    printf("%-18s%llu\n", "io_operations:", ringOperations);
+#endif
+    printf("%-18s%llu\n", "cache_size:", cacheSize);
+    printf("%-18s%llu\n", "cache_hits:", hits);
+    printf("%-18s%llu\n", "cache_misses:", misses);
+    printf("%-18s%.2f\n", "cache_hit_rate:", hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+    printf("%-18s%llu\n", "cache_evictions:", evictions);
+    printf("%-18s%llu\n", "cache_writebacks:", writeBacks);
+    printf("%-18s%llu\n", "cache_forced:", forced);
+    printf("%-18s%llu\n", "checksum_errors:", errors);
+    printf("%-18s%llu\n", "checksum_repairs:", repairs);
+    printf("%-18s%llu\n", "scrubbed_records:", scrubbed);
+    printf("%-18s%llu\n", "store_version:", storeVersion(store));
+    printf("%-18s%llu\n", "checkpoint_lsn:", checkpointLsn);
+    printf("%-18s%llu\n", "journal_tail:", journalTail);
+    printf("%-18s%llu\n", "checkpoints:", checkpoints);
+    printf("%-18s%llu\n", "replayed_records:", replayed);
+    printf("%-18s%llu\n", "commits:", commits);
+    printf("%-18s%.2f\n", "commit_size:", commits ? (double)committed / commits : 0.0);
+    printf("%-18s%llu\n", "view_lsn:", viewLsn);
+    printf("%-18s%llu\n", "view_undone:", viewUndone);
+    printf("%-18s%llu\n", "read_retries:", readRetries);
+    {
+        struct replicationStatus status;
+        int primary = readReplication(store->fileName, ".ship", &status);
+
+        if (primary || readReplication(store->fileName, ".repl", &status)) {
+            printf("%-18s%s\n", "replication:", primary ? "primary" : "standby");
+            printf("%-18s%llu\n", "standby_lsn:", status.standbyLsn);
+            printf("%-18s%llu\n", "standby_lag:", status.primaryLsn - status.standbyLsn);
+            printf("%-18s%lld\n", "standby_age_ms:", wallClockMs() - status.updated);
+        }
+    }
+    printf("%-18s%d\n", "pool_threads:", taskPool.workers);
+    printf("%-18s%llu\n", "pool_ranges:", __atomic_load_n(&taskPool.ranges, __ATOMIC_RELAXED));
+    printf("%-18s%llu\n", "pool_splits:", __atomic_load_n(&taskPool.splits, __ATOMIC_RELAXED));
+    printf("%-18s%llu\n", "pool_steals:", __atomic_load_n(&taskPool.steals, __ATOMIC_RELAXED));
+} // end function showStatistics
+
+// Stackless coroutines (protothreads). A handler keeps its resume point
+// in co->line and anything it needs across a suspension in the structure
+// co points to, so a suspended request costs a few bytes rather than a
+// thread. CO_AWAIT returns 0 to the event loop until cond holds, and
+// the next call resumes at the same point; CO_END returns 1.
+#define CO_BEGIN(co) switch ((co)->line) { case 0:
+#define CO_AWAIT(co, cond) \
+    do { (co)->line = __LINE__; __attribute__((fallthrough)); case __LINE__: if (!(cond)) return 0; } while (0)
+#define CO_END(co) } (co)->line = 0; return 1
+
+#define SERVE_MAX_LINE 256       // longest request line
+#define SERVE_MAX_EVENTS 64      // epoll events taken per wait
+#define SERVE_RETRY_MS 1         // loop tick while requests wait for a lock
+#define SERVE_MAX_PENDING 65536  // reply bytes a client may leave unread
+#define GROUP_COMMIT_MAX 256     // changes one group commit may hold
+#define REPLICA_MAX_ROWS 10000   // rows one LIST, SEARCH or PAGE returns at most
+
+// One request of the line protocol, as a coroutine
+struct serveRequest {
+    int line;                   // coroutine resume point (0 = start)
+    char text[SERVE_MAX_LINE];  // the request line
+    char command[16];
+    unsigned int account;       // LIST and SEARCH: the account to list after
+    char lastName[LAST_NAME_SIZE];
+    char firstName[FIRST_NAME_SIZE];
+    long long amount;           // UPDATE transaction or NEW balance, in cents
+    struct recordStore *shard;  // shard holding account
+    char prefix[LAST_NAME_SIZE]; // SEARCH: last name prefix
+    int criterion;              // PAGE: 1 balance, 2 name
+    int order;                  // PAGE: 1 ascending, 2 descending
+    size_t offset;              // PAGE: rows to skip
+    size_t limit;               // LIST, SEARCH and PAGE: rows wanted
+}; // end structure serveRequest
+
+// One connection to the engine server
+struct serveClient {
+    int fd;
+    char in[SERVE_MAX_LINE];    // bytes received, not yet a whole line
+    size_t inUsed;
+    char *out;                  // reply bytes the socket did not take yet
+    size_t outUsed;
+    size_t outCapacity;
+    size_t outReady;            // of those, the ones that may be sent (the rest await a group commit)
+    int held;                   // on the group commit's list of held clients
+    struct serveClient *nextHeld;
+    int busy;                   // request holds a request in progress
+    int waiting;                // on the list of suspended requests
+    int hangup;                 // the peer sent all it will send
+    int closing;                // handle no more requests; close once the replies are sent
+    struct serveRequest request;
+    struct serveClient *nextWaiting;
+}; // end structure serveClient
+
+// Changes of the server waiting to be committed together. A change is
+// made in the cache and staged in the journal under its shard's journal
+// lock, which the group keeps; replies made while the group is open are
+// held, so no client hears of a change (its own or, through a GET,
+// another's) before its journal entry is written. The loop commits the
+// group when a turn brings no new changes or it is full: one journal
+// write and, with I7_DURABLE, one fdatasync per shard for all of them.
+// The group thus grows with the number of clients writing at once and
+// stays at one change when there is only one.
+struct groupCommit {
+    size_t changes;             // changes made since the last commit
+    unsigned long long locked;  // bit s: the group holds shard s's journal lock
+    struct serveClient *held;   // clients with replies held for the commit
+}; // end structure groupCommit
+
+volatile sig_atomic_t serveStop = 0; // set by SIGINT/SIGTERM
+int serveReplica = 0;                 // i7 --replica: answer reads from the snapshot, refuse changes
+struct groupCommit serveGroup;
+
+void serveSignal(int signal) {
+    (void)signal;
+    serveStop = 1;
+}
+
+// queue a reply line for client and send what the socket takes now
+void serveReply(struct serveClient *client, const char *format, ...) {
+    char line[SERVE_MAX_LINE * 2];
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(line, sizeof(line) - 1, format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+    if ((size_t)length > sizeof(line) - 2) {
+        length = (int)sizeof(line) - 2;
+    }
+    line[length++] = '\n';
+    if (client->outUsed + (size_t)length > client->outCapacity) {
+        size_t capacity = client->outCapacity ? client->outCapacity * 2 : 1024;
+        char *grown;
+
+        while (capacity < client->outUsed + (size_t)length) {
+            capacity *= 2;
+        }
+        if ((grown = realloc(client->out, capacity)) == NULL) {
+            client->closing = 1;
+            return;
+        }
+        client->out = grown;
+        client->outCapacity = capacity;
+    }
+    memcpy(client->out + client->outUsed, line, (size_t)length);
+    client->outUsed += (size_t)length;
+    if (serveGroup.changes == 0 && !client->held) {
+        client->outReady = client->outUsed;
+    } else if (!client->held) {
+        client->held = 1;
+        client->nextHeld = serveGroup.held;
+        serveGroup.held = client;
+    }
+}
+
+// send queued replies as far as the socket takes them, except those
+// held for a group commit; if the connection is gone they are dropped
+// and the client is closing
+void serveFlush(struct serveClient *client) {
+    size_t sent = 0;
+
+    while (sent < client->outReady) {
+        ssize_t n = send(client->fd, client->out + sent, client->outReady - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                client->closing = 1;
+                sent = client->outReady;
+            }
+            break;
+        }
+        sent += (size_t)n;
+    }
+    memmove(client->out, client->out + sent, client->outUsed - sent);
+    client->outUsed -= sent;
+    client->outReady -= sent;
+}
+
+// commit the group's changes, release its journal locks and let the
+// held replies go. If the journal could not be written every held reply
+// becomes an ERR line, since none of them may report a change that is
+// not yet on disk; the changes stay staged for the next group.
+void serveCommit(struct recordStore *store) {
+    size_t i;
+    int committed = 1;
+
+    for (i = 0; i < store->shardCount; i++) {
+        store->shards[i].groupLocked = 0;
+    }
+    if (serveGroup.changes > 0) {
+        TRACE_SPAN("group commit", "journal");
+        committed = commitRecords(store); // each shard's commit ends by releasing its lock
+    }
+    for (i = 0; i < store->shardCount; i++) {
+        if (serveGroup.locked & (1ULL << i)) {
+            flock(fileno(store->shards[i].journalPtr), LOCK_UN);
+        }
+    }
+    serveGroup.changes = 0;
+    serveGroup.locked = 0;
+    while (serveGroup.held != NULL) {
+        struct serveClient *client = serveGroup.held;
+
+        serveGroup.held = client->nextHeld;
+        client->held = 0;
+        if (!committed) {
+            size_t lines = 0, at;
+
+            for (at = client->outReady; at < client->outUsed; at++) {
+                lines += client->out[at] == '\n';
+            }
+            client->outUsed = client->outReady;
+            while (lines-- > 0) {
+                serveReply(client, "ERR the journal could not be written; the change is kept for the next commit");
+            }
+        }
+        client->outReady = client->outUsed;
+        serveFlush(client);
+    }
+}
+
+// take shard's journal lock for the group unless it has it already;
+// 0 while another engine holds it
+int serveLock(struct recordStore *store, struct recordStore *shard) {
+    unsigned long long bit = 1ULL << (shard - store->shards);
+
+    if (!(serveGroup.locked & bit)) {
+        if (flock(fileno(shard->journalPtr), LOCK_EX | LOCK_NB) != 0) {
+            return 0;
+        }
+        serveGroup.locked |= bit;
+        shard->groupLocked = 1;
+    }
+    return 1;
+}
+
+// parse a listing request (LIST, SEARCH or PAGE), which only replicas
+// answer; returns 0 (with an error reply queued) if it is not valid
+int serveParseListing(struct serveClient *client) {
+    struct serveRequest *request = &client->request;
+    unsigned long offset = 0, limit = 0;
+    int valid;
+
+    if (!serveReplica) {
+        serveReply(client, "ERR %s is answered by replicas (i7 --replica)", request->command);
+        return 0;
+    }
+    request->prefix[0] = '\0';
+    request->account = 0;
+    if (strcmp(request->command, "LIST") == 0) {
+        valid = sscanf(request->text, "%*s %u %lu", &request->account, &limit) == 2;
+    } else if (strcmp(request->command, "SEARCH") == 0) {
+        valid = sscanf(request->text, "%*s %31s %u %lu", request->prefix, &request->account, &limit) == 3;
+    } else {
+        valid = sscanf(request->text, "%*s %d %d %lu %lu", &request->criterion, &request->order, &offset, &limit) == 4 &&
+                (request->criterion == 1 || request->criterion == 2) && (request->order == 1 || request->order == 2);
+    }
+    if (!valid || limit == 0) {
+        serveReply(client, "ERR invalid %s request", request->command);
+        return 0;
+    }
+    request->offset = offset;
+    request->limit = limit < REPLICA_MAX_ROWS ? limit : REPLICA_MAX_ROWS;
+    if (request->offset + request->limit < request->offset) {
+        serveReply(client, "ERR invalid %s request", request->command);
+        return 0;
+    }
+    return 1;
+}
+
+// parse the request line into request; returns 0 (with an error reply
+// queued) if it is not a request
+int serveParse(struct serveClient *client) {
+    struct serveRequest *request = &client->request;
+    char amountText[32];
+    int fields = sscanf(request->text, "%15s %u", request->command, &request->account);
+
+    if (fields < 1) {
+        request->command[0] = '\0';
+        return 1; // blank line, ignored
+    }
+    if (strcmp(request->command, "QUIT") == 0) {
+        return 1;
+    }
+    if (strcmp(request->command, "LIST") == 0 || strcmp(request->command, "SEARCH") == 0 ||
+        strcmp(request->command, "PAGE") == 0) {
+        return serveParseListing(client);
+    }
+    if (fields < 2 || request->account == 0) {
+        serveReply(client, "ERR expected an account number");
+        return 0;
+    }
+    if (!accountInRange(request->account)) {
+        serveReply(client, "ERR account numbers run from 1 to %u", maxAccount);
+        return 0;
+    }
+    if (strcmp(request->command, "UPDATE") == 0) {
+        if (sscanf(request->text, "%*s %*u %31s", amountText) != 1 || !parseCents(amountText, &request->amount)) {
+            serveReply(client, "ERR invalid amount");
+            return 0;
+        }
+    } else if (strcmp(request->command, "NEW") == 0) {
+        // widths are LAST_NAME_SIZE - 1 and FIRST_NAME_SIZE - 1
+        if (sscanf(request->text, "%*s %*u %31s %23s %31s", request->lastName, request->firstName, amountText) != 3 ||
+            !parseCents(amountText, &request->amount)) {
+            serveReply(client, "ERR invalid balance");
+            return 0;
+        }
+        sanitizeString(request->lastName, sizeof(request->lastName));
+        sanitizeString(request->firstName, sizeof(request->firstName));
+    } else if (strcmp(request->command, "GET") != 0 && strcmp(request->command, "DELETE") != 0) {
+        serveReply(client, "ERR unknown request %s", request->command);
+        return 0;
+    }
+    return 1;
+}
+
+// a change was staged: count it into the group, or commit it now if the
+// store has no journal to group it in
+void serveChanged(struct recordStore *store) {
+    serveGroup.changes++;
+    if (serveGroup.locked == 0) {
+        serveCommit(store);
+    }
+}
+
+// carry out a parsed request, as updateRecord, newRecord and deleteRecord
+// do, except that changes are committed with the rest of the group
+void serveApply(struct recordStore *store, struct serveClient *client) {
+    struct serveRequest *request = &client->request;
+    struct clientData record;
+    char amount[24];
+
+    readRecord(store, request->account, &record);
+    if (strcmp(request->command, "GET") == 0 || strcmp(request->command, "UPDATE") == 0) {
+        if (record.acctNum == 0) {
+            serveReply(client, "ERR account %u has no information", request->account);
+            return;
+        }
+        if (request->command[0] == 'U') {
+            if (__builtin_add_overflow(record.balance, request->amount, &record.balance)) {
+                serveReply(client, "ERR balance of account %u would overflow", request->account);
+                return;
+            }
+            writeRecord(store, request->account, &record);
+            serveChanged(store);
+        }
+    } else if (strcmp(request->command, "NEW") == 0) {
+        if (record.acctNum != 0) {
+            serveReply(client, "ERR account %u already contains information", request->account);
+            return;
+        }
+        record.acctNum = request->account;
+        strcpy(record.lastName, request->lastName);
+        strcpy(record.firstName, request->firstName);
+        record.balance = request->amount;
+        writeRecord(store, request->account, &record);
+        serveChanged(store);
+    } else { // DELETE
+        if (record.acctNum == 0) {
+            serveReply(client, "ERR account %u does not exist", request->account);
+            return;
+        }
+        record.acctNum = 0; // blanked; it keeps the names, as in deleteRecord
+        record.balance = 0;
+        writeRecord(store, request->account, &record);
+        serveChanged(store);
+        serveReply(client, "OK %u", request->account);
+        return;
+    }
+    serveReply(client, "OK %u %s %s %s", record.acctNum, record.lastName, record.firstName,
+               formatCents(record.balance, amount));
+}
+
+// LIST and SEARCH on a replica: up to limit accounts after the request's
+// account, in account order, whose last names start with the prefix,
+// then "END <account>" to list after next time, or "END 0" at the end
+void replicaList(struct recordStore *store, struct serveClient *client) {
+    struct serveRequest *request = &client->request;
+    const struct balanceSnapshot *snap = refreshSnapshot(store);
+    size_t prefixLength = strlen(request->prefix), rows = 0, slot;
+    struct clientData record;
+    char amount[24];
+
+    for (slot = request->account; slot < snap->slotCount; slot++) {
+        int index = snap->position[slot];
+
+        if (index == -1 || strncmp(snap->names + snap->nameOffset[index], request->prefix, prefixLength) != 0) {
+            continue;
+        }
+        if (rows == request->limit) { // there is more
+            serveReply(client, "END %u", record.acctNum);
+            return;
+        }
+        snapshotRecord(snap, (unsigned int)slot + 1, &record);
+        serveReply(client, "ROW %u %s %s %s", record.acctNum, record.lastName, record.firstName,
+                   formatCents(record.balance, amount));
+        rows++;
+    }
+    serveReply(client, "END 0");
+}
+
+// PAGE on a replica: rows offset+1 .. offset+limit of a sorted listing,
+// picked from the snapshot as sortPage picks them from the file (a
+// bounded heap, or nth_element for deep pages), then "END <total>"
+void replicaPage(struct recordStore *store, struct serveClient *client) {
+    struct serveRequest *request = &client->request;
+    const struct balanceSnapshot *snap = refreshSnapshot(store);
+    const struct sortSpec *spec = sortSpecFor(request->criterion, request->order == 1);
+    struct sortPage page = {store, spec, request->offset, request->limit, 0, NULL, 0, 0};
+    size_t wanted = request->offset + request->limit, size = spec->entrySize, i;
+    int useHeap = wanted <= TOP_K_HEAP_MAX;
+    struct nameEntry entry; // large enough for either entry type
+    struct clientData record;
+    char amount[24];
+
+    page.capacity = useHeap ? wanted : snap->count;
+    if ((page.entries = malloc((page.capacity ? page.capacity : 1) * size)) == NULL) {
+        serveReply(client, "ERR not enough memory for the page");
+        return;
+    }
+    for (i = 0; i < snap->count; i++) {
+        snapshotRecord(snap, snap->acctNum[i], &record);
+        spec->makeEntry(spec, &record, snap->acctNum[i] - 1, &entry);
+        if (useHeap) {
+            pageHeapTake(&entry, &page);
+        } else {
+            pageCollectTake(&entry, &page);
+        }
+    }
+    if (useHeap) {
+        qsort(page.entries, page.count, size, spec->compare);
+    } else {
+        if (wanted > page.count) {
+            wanted = page.count;
+        }
+        if (request->offset < wanted) {
+            selectEntries(page.entries, page.count, wanted - 1, spec);
+            selectEntries(page.entries, wanted, request->offset, spec);
+            qsort(page.entries + request->offset * size, wanted - request->offset, size, spec->compare);
+        }
+        page.count = wanted;
+    }
+
+    for (i = request->offset; i < page.count; i++) {
+        snapshotRecord(snap, ((const struct sortEntry *)(page.entries + i * size))->slot + 1, &record);
+        serveReply(client, "ROW %zu %u %s %s %s", i + 1, record.acctNum, record.lastName, record.firstName,
+                   formatCents(record.balance, amount));
+    }
+    serveReply(client, "END %zu", snap->count);
+    free(page.entries);
+}
+
+// a parsed request on a replica: reads come from the snapshot, brought
+// up to date from the journal tail first, so a replica never takes a
+// lock another engine waits for
+void replicaApply(struct recordStore *store, struct serveClient *client) {
+    struct serveRequest *request = &client->request;
+    struct clientData record;
+    char amount[24];
+
+    if (strcmp(request->command, "LIST") == 0 || strcmp(request->command, "SEARCH") == 0) {
+        replicaList(store, client);
+    } else if (strcmp(request->command, "PAGE") == 0) {
+        replicaPage(store, client);
+    } else if (strcmp(request->command, "GET") != 0) {
+        serveReply(client, "ERR read-only replica");
+    } else if (!snapshotRecord(refreshSnapshot(store), request->account, &record)) {
+        serveReply(client, "ERR account %u has no information", request->account);
+    } else {
+        serveReply(client, "OK %u %s %s %s", record.acctNum, record.lastName, record.firstName,
+                   formatCents(record.balance, amount));
+    }
+}
+
+// The request of client as a coroutine. Changes wait for the journal
+// lock of the account's shard without blocking the loop: the lock is
+// tried, and while another engine holds it the request suspends and is
+// tried again on the next tick. Once it is ours the group keeps it until
+// its commit, when commitRecords takes it again at once (flock locks
+// belong to the open file) and releases it. Returns 1 once the request
+// is done.
+int serveRun(struct recordStore *store, struct serveClient *client) {
+    struct serveRequest *request = &client->request;
+
+    CO_BEGIN(request);
+    if (!serveParse(client) || request->command[0] == '\0') {
+        // answered already, or a blank line
+    } else if (strcmp(request->command, "QUIT") == 0) {
+        serveReply(client, "OK bye");
+        client->closing = 1;
+    } else if (serveReplica) {
+        replicaApply(store, client);
+    } else if (strcmp(request->command, "GET") == 0 ||
+               (request->shard = shardOf(store, request->account))->journalPtr == NULL) {
+        serveApply(store, client);
+    } else {
+        CO_AWAIT(request, serveLock(store, request->shard));
+        serveApply(store, client);
+    }
+    CO_END(request);
+}
+
+// start the next whole request line of client, and run requests until
+// one suspends or the input holds no whole line
+void serveAdvance(struct recordStore *store, struct serveClient *client) {
+    for (;;) {
+        char *newline;
+        size_t length;
+
+        if (!client->busy) {
+            if (client->outUsed > SERVE_MAX_PENDING) {
+                serveFlush(client); // still backed up: resumed when the socket drains
+            }
+            if (client->closing || client->outUsed > SERVE_MAX_PENDING ||
+                (newline = memchr(client->in, '\n', client->inUsed)) == NULL) {
+                return;
+            }
+            length = (size_t)(newline - client->in);
+            memcpy(client->request.text, client->in, length);
+            client->request.text[length] = '\0';
+            if (length > 0 && client->request.text[length - 1] == '\r') {
+                client->request.text[length - 1] = '\0';
+            }
+            client->inUsed -= length + 1;
+            memmove(client->in, newline + 1, client->inUsed);
+            client->request.line = 0;
+            client->busy = 1;
+        }
+        TRACE_SPAN("serve request", "request");
+        if (!serveRun(store, client)) {
+            return; // suspended; resumed from the waiting list
+        }
+        client->busy = 0;
+    }
+}
+
+// Take what the socket has and handle the whole lines. Sockets are edge
+// triggered, so reading goes on until it would block, except while the
+// client's request is suspended or its replies are backed up; the
+// waiting list or the socket draining calls this again then.
+void servePump(struct recordStore *store, struct serveClient *client) {
+    for (;;) {
+        ssize_t got;
+
+        serveAdvance(store, client);
+        if (client->closing || client->hangup) {
+            return;
+        }
+        if (client->inUsed == sizeof(client->in)) {
+            if (memchr(client->in, '\n', client->inUsed) == NULL) {
+                serveReply(client, "ERR request line too long");
+                client->closing = 1;
+            }
+            return;
+        }
+        got = recv(client->fd, client->in + client->inUsed, sizeof(client->in) - client->inUsed, 0);
+        if (got > 0) {
+            client->inUsed += (size_t)got;
+        } else if (got == 0) {
+            client->hangup = 1; // answer what it sent, then close
+        } else if (errno != EINTR) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                client->closing = 1;
+            }
+            return;
+        }
+    }
+}
+
+// whether client can be closed: it quit, failed or hung up, and has
+// nothing left to handle or send
+int serveDone(const struct serveClient *client) {
+    return (client->closing || client->hangup) && !client->busy && !client->held && client->outUsed == 0 &&
+           (client->closing || memchr(client->in, '\n', client->inUsed) == NULL);
+}
+
+// open the listening socket: a TCP port on the loopback address if
+// address is a number, otherwise a Unix socket path; -1 on failure
+int serveListen(const char *address) {
+    int fd;
+
+    if (address[0] != '\0' && strspn(address, "0123456789") == strlen(address)) {
+        struct sockaddr_in inet;
+        int on = 1;
+
+        memset(&inet, 0, sizeof(inet));
+        inet.sin_family = AF_INET;
+        inet.sin_port = htons((unsigned short)atoi(address));
+        inet.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd >= 0 && (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+                        bind(fd, (struct sockaddr *)&inet, sizeof(inet)) != 0)) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        struct sockaddr_un local;
+
+        memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(local.sun_path)) {
+            return -1;
+        }
+        strcpy(local.sun_path, address);
+        unlink(address); // left behind by an earlier server
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd >= 0 && bind(fd, (struct sockaddr *)&local, sizeof(local)) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0 && listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// close client and drop it from the waiting list
+void serveClose(struct serveClient *client, struct serveClient **waitingList) {
+    struct serveClient **link = waitingList;
+
+    while (*link != NULL && *link != client) {
+        link = &(*link)->nextWaiting;
+    }
+    if (*link == client) {
+        *link = client->nextWaiting;
+    }
+    close(client->fd);
+    free(client->out);
+    free(client);
+}
+
+// Serve the line protocol on address until SIGINT or SIGTERM. One
+// thread runs an epoll loop over every connection; each request runs as
+// a coroutine, so thousands of clients need no thread each, and a
+// request waiting for another engine's journal lock suspends instead of
+// stopping the loop. Changes are committed in groups (see groupCommit).
+// Requests, one per line:
+//   GET <account>                       OK <account> <last> <first> <balance>
+//   UPDATE <account> <amount>           the record after the change
+//   NEW <account> <last> <first> <bal>  the new record
+//   DELETE <account>                    OK <account>
+//   QUIT
+// Failures are answered "ERR <reason>". Run as a replica (i7 --replica)
+// the server refuses changes and answers from the columnar snapshot,
+// which it builds once and then keeps up to date from the journal tail
+// alone; it takes no lock the primary's engines take, so replicas can be
+// added until reads scale. Replicas also answer listings, one "ROW" line
+// per account and an "END" line (see replicaList and replicaPage):
+//   LIST <after> <limit>                accounts after <after>, in order
+//   SEARCH <prefix> <after> <limit>     the same, last name starting <prefix>
+//   PAGE <crit> <order> <off> <limit>   as menu option 9: ROW <rank> ...
+// Returns 0 if it could not listen.
+int serve(struct recordStore *store, const char *address, int replica) {
+    struct epoll_event event, events[SERVE_MAX_EVENTS];
+    struct serveClient *waitingList = NULL;
+    unsigned long long commits = 0, committed = 0;
+    int listener = serveListen(address), epoll, i;
+
+    if (listener < 0 || (epoll = epoll_create1(0)) < 0) {
+        if (listener >= 0) {
+            close(listener);
+        }
+        return 0;
+    }
+    signal(SIGINT, serveSignal);
+    signal(SIGTERM, serveSignal);
+    signal(SIGPIPE, SIG_IGN);
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL; // the listener
+    epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event);
+    serveReplica = replica;
+    if (replica) {
+        refreshSnapshot(store); // the full scan, before any client waits on it
+    }
+    fprintf(stderr, "i7: %s on %s\n", serveReplica ? "replica" : "serving", address);
+
+    while (!serveStop) {
+        // with a group open, only take what has already arrived
+        size_t changes = serveGroup.changes;
+        int ready = epoll_wait(epoll, events, SERVE_MAX_EVENTS,
+                               changes > 0 ? 0 : waitingList != NULL ? SERVE_RETRY_MS : -1);
+        struct serveClient **link;
+
+        for (i = 0; i < ready; i++) {
+            struct serveClient *client = events[i].data.ptr;
+
+            if (client == NULL) {
+                int fd;
+
+                while ((fd = accept(listener, NULL, NULL)) >= 0) {
+                    if (fcntl(fd, F_SETFL, O_NONBLOCK) != 0 ||
+                        (client = calloc(1, sizeof(struct serveClient))) == NULL) {
+                        close(fd);
+                        continue;
+                    }
+                    client->fd = fd;
+                    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+                    event.data.ptr = client;
+                    epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+                }
+                continue;
+            }
+
+            servePump(store, client);
+            serveFlush(client);
+            if (client->busy && !client->waiting) {
+                client->waiting = 1;
+                client->nextWaiting = waitingList;
+                waitingList = client;
+            }
+            if (serveDone(client)) {
+                serveClose(client, &waitingList);
+            }
+        }
 
-// clientData structure definition
-struct clientData {
-    unsigned int acctNum; // account number
-    char lastName[15];    // account last name
-    char firstName[10];   // account first name
-    double balance;       // account balance
-}; // end structure clientData
+        // resume the suspended requests
+        link = &waitingList;
+        while (*link != NULL) {
+            struct serveClient *client = *link;
 
-// Global variable to hold sorting order (ascending or descending)
-int ascending_order = 1; // 1 for ascending, 0 for descending
+            servePump(store, client);
+            serveFlush(client);
+            if (client->busy) {
+                link = &client->nextWaiting;
+                continue;
+            }
+            *link = client->nextWaiting;
+            client->waiting = 0;
+            if (serveDone(client)) {
+                serveClose(client, &waitingList);
+            }
+        }
 
-// Function to clean up and sanitize names (strip out non-printable characters)
-void sanitizeString(char *str, int maxLength) {
-    int i, j = 0;
-    for (i = 0; i < maxLength && str[i] != '\0'; i++) {
-        if (isprint(str[i])) {
-            str[j++] = str[i];
+        // a turn that added nothing closes the group
+        if (serveGroup.locked != 0 && (serveGroup.changes == changes || serveGroup.changes >= GROUP_COMMIT_MAX)) {
+            serveCommit(store);
         }
     }
-    str[j] = '\0'; // Null terminate the cleaned string
+    serveCommit(store);
+    for (i = 0; i < (int)store->shardCount; i++) {
+        commits += store->shards[i].commits;
+        committed += store->shards[i].committed;
+    }
+    if (!replica) {
+        fprintf(stderr, "i7: %llu changes in %llu commits\n", committed, commits);
+    }
+
+    close(epoll);
+    close(listener);
+    if (strspn(address, "0123456789") != strlen(address)) {
+        unlink(address);
+    }
+    return 1;
 }
 
-// Function to compare two accounts by balance (for low-to-high or high-to-low)
-int compareByBalance(const void *a, const void *b) {
-    struct clientData *accountA = (struct clientData *)a;
-    struct clientData *accountB = (struct clientData *)b;
+#define SHIP_HELLO 1 // standby -> primary: shard has applied up to lsn; end = the standby's shard count
+#define SHIP_ENTRY 2 // primary -> standby: a journal entry of shard; end = the primary's journal end
+#define SHIP_END 3   // primary -> standby: nothing new in shard; end = the primary's journal end
+#define SHIP_ACK 4   // standby -> primary: shard has applied up to lsn
+#define SHIP_BATCH 256        // journal entries read and sent at a time
+#define SHIP_POLL_MS 10       // wait for new journal entries or acks
+#define SHIP_HEARTBEAT_MS 200 // idle time after which the primary says it is alive
+#define SHIP_RETRY_MS 500     // wait before reconnecting to the standby
+
+// One message of the replication link. Both ends run on the same host,
+// so frames go over the socket as they are laid out in memory.
+struct shipFrame {
+    unsigned int kind;       // SHIP_HELLO, SHIP_ENTRY, SHIP_END or SHIP_ACK
+    unsigned int shard;
+    unsigned long long lsn;  // HELLO, ACK: the standby's last applied entry of shard
+    unsigned long long end;  // see the kinds
+    struct journalEntry entry; // ENTRY only
+}; // end structure shipFrame
+
+// connect to a standby listening on address (a loopback port if it is a
+// number, otherwise a Unix socket path); -1 on failure
+int shipConnect(const char *address) {
+    int fd;
+
+    if (address[0] != '\0' && strspn(address, "0123456789") == strlen(address)) {
+        struct sockaddr_in inet;
 
-    if (ascending_order) {
-        return (accountA->balance > accountB->balance) - (accountA->balance < accountB->balance);
+        memset(&inet, 0, sizeof(inet));
+        inet.sin_family = AF_INET;
+        inet.sin_port = htons((unsigned short)atoi(address));
+        inet.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&inet, sizeof(inet)) != 0) {
+            close(fd);
+            fd = -1;
+        }
     } else {
-        return (accountB->balance > accountA->balance) - (accountB->balance < accountA->balance);
+        struct sockaddr_un local;
+
+        memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(local.sun_path)) {
+            return -1;
+        }
+        strcpy(local.sun_path, address);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&local, sizeof(local)) != 0) {
+            close(fd);
+            fd = -1;
+        }
     }
+    return fd;
 }
 
-// Function to compare two accounts by name (alphabetical order)
-int compareByName(const void *a, const void *b) {
-    struct clientData *accountA = (struct clientData *)a;
-    struct clientData *accountB = (struct clientData *)b;
-    
-    int cmpLast = strcmp(accountA->lastName, accountB->lastName);
-    
-    if (cmpLast == 0) {
-        return (ascending_order ? strcmp(accountA->firstName, accountB->firstName) : strcmp(accountB->firstName, accountA->firstName));
+// send count frames whole; 0 if the link failed
+int shipSend(int fd, const struct shipFrame *frames, size_t count) {
+    const char *data = (const char *)frames;
+    size_t length = count * sizeof(struct shipFrame), sent = 0;
+
+    while (sent < length) {
+        ssize_t n = send(fd, data + sent, length - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        sent += (size_t)n;
     }
-    
-    return (ascending_order ? cmpLast : -cmpLast);
+    return 1;
 }
 
-// Function to handle the sort option (after user selects '5' for sorting)
-void sortOption(FILE *fPtr) {
-    int criterion, ascending;
+// receive one whole frame, waiting for it; 0 if the link closed or failed
+int shipReceive(int fd, struct shipFrame *frame) {
+    char *data = (char *)frame;
+    size_t got = 0;
 
-    // Ask the user for the sorting criterion
-    printf("\nChoose sorting criterion:\n");
-    printf("1 - Sort by Balance\n");
-    printf("2 - Sort by Last Name and First Name\n");
-    printf("3 - Show Account with Maximum Balance\n");
-    printf("4 - Show Account with Minimum Balance\n");
-    printf("Enter your choice: ");
-    scanf("%d", &criterion);
+    while (got < sizeof(*frame)) {
+        ssize_t n = recv(fd, data + got, sizeof(*frame) - got, 0);
+        if (n < 0 && errno == EINTR) {
+            if (serveStop) {
+                return 0;
+            }
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        got += (size_t)n;
+    }
+    return 1;
+}
 
-    if (criterion == 3 || criterion == 4) {
-        // For min/max options, we don't need sorting order
-        sortAccounts(fPtr, criterion, 1);
-        return;
+// Primary side of journal shipping (i7 --ship ADDRESS, run next to the
+// primary's credit.dat). Connects to the standby, learns how far each of
+// its shards has applied the journal, and from then on sends every
+// journal entry committed by any engine on this store, in LSN order, as
+// soon as it appears. The standby's acknowledgements go to credit.ship.
+// A lost link is retried until SIGINT or SIGTERM. Returns 0 if the
+// standby's store does not match this one.
+int shipJournal(struct recordStore *store, const char *address) {
+    unsigned long long next[MAX_SHARDS], end[MAX_SHARDS] = {0}, acked[MAX_SHARDS] = {0};
+    long long heard = 0; // when the standby last acknowledged
+    struct shipFrame *frames = malloc(SHIP_BATCH * sizeof(struct shipFrame));
+    struct journalEntry *entries = malloc(SHIP_BATCH * sizeof(struct journalEntry));
+    char path[512];
+    int statusFd, matched = 1;
+    size_t s;
+
+    for (s = 0; s < store->shardCount; s++) {
+        if (store->shards[s].journalPtr == NULL) {
+            matched = 0; // nothing to ship
+        }
     }
+    if (frames == NULL || entries == NULL || !matched) {
+        free(frames);
+        free(entries);
+        return 0;
+    }
+    sidecarFileName(store->fileName, ".repl", path, sizeof(path));
+    unlink(path); // this store is the primary now
+    sidecarFileName(store->fileName, ".ship", path, sizeof(path));
+    statusFd = open(path, O_WRONLY | O_CREAT, 0644);
+    signal(SIGINT, serveSignal);
+    signal(SIGTERM, serveSignal);
+    signal(SIGPIPE, SIG_IGN);
 
-    // Ask the user for ascending or descending order (only for sorting options 1 & 2)
-    printf("\nChoose sorting order:\n");
-    printf("1 - Ascending\n");
-    printf("2 - Descending\n");
-    printf("Enter your choice: ");
-    scanf("%d", &ascending);
+    while (!serveStop && matched) {
+        int fd = shipConnect(address), linked = 1;
+        long long quiet = wallClockMs();
+        struct shipFrame hello;
 
-    // Convert input to 0 or 1 for ascending or descending
-    ascending = (ascending == 1) ? 1 : 0;
+        if (fd < 0) {
+            // the primary keeps going: show the standby falling behind
+            unsigned long long primaryLsn = 0, standbyLsn = 0;
 
-    // Call sortAccounts with the selected criterion and order
-    sortAccounts(fPtr, criterion, ascending);
-}
+            for (s = 0; s < store->shardCount; s++) {
+                primaryLsn += journalCommitted(&store->shards[s]);
+                standbyLsn += acked[s];
+            }
+            writeReplication(statusFd, primaryLsn, standbyLsn, heard);
+            poll(NULL, 0, SHIP_RETRY_MS);
+            continue;
+        }
+        // one hello per shard says where to start
+        for (s = 0; s < store->shardCount && linked; s++) {
+            linked = shipReceive(fd, &hello) && hello.kind == SHIP_HELLO && hello.shard == s;
+            if (linked && hello.end != store->shardCount) {
+                fprintf(stderr, "i7: the standby has %llu shards, this store %zu\n", hello.end, store->shardCount);
+                matched = linked = 0;
+            } else if (linked && hello.lsn > journalCommitted(&store->shards[s])) {
+                fprintf(stderr, "i7: the standby is ahead of this store's journal\n");
+                matched = linked = 0;
+            }
+            if (linked) {
+                next[s] = hello.lsn + 1;
+                acked[s] = hello.lsn;
+                heard = wallClockMs();
+            }
+        }
+        if (linked) {
+            fprintf(stderr, "i7: shipping the journal to %s\n", address);
+        }
 
-// Main function
-int main(int argc, char *argv[])
-{
-    FILE *cfPtr;         // credit.dat file pointer
-    unsigned int choice; // user's choice
+        while (linked && !serveStop) {
+            unsigned long long primaryLsn = 0, standbyLsn = 0;
+            struct pollfd wait = {fd, POLLIN, 0};
+            size_t sent = 0;
 
-    // fopen opens the file; exits if file cannot be opened
-    if ((cfPtr = fopen("credit.dat", "rb+")) == NULL)
-    {
-        printf("%s: File could not be opened.\n", argv[0]);
-        exit(-1);
-    }
+            for (s = 0; s < store->shardCount && linked; s++) {
+                struct recordStore *shard = &store->shards[s];
 
-    // enable user to specify action
-    while ((choice = enterChoice()) != 6)  // CHANGED: from 5 to 6
-    {
-        switch (choice)
-        {
-        case 1:  // create text file from record file
-            textFile(cfPtr);
-            break;
-        case 2:  // update record
-            updateRecord(cfPtr);
-            break;
-        case 3:  // create record
-            newRecord(cfPtr);
-            break;
-        case 4:  // delete existing record
-            deleteRecord(cfPtr);
-            break;
-        case 5:  // sort accounts by balance or other criteria
-            sortOption(cfPtr);  // Handle sort option
-            break;
-        default:
-            puts("Incorrect choice");
-            break;
+                // a batch per shard and turn, so the acknowledgements are
+                // read between batches and never back up
+                end[s] = journalCommitted(shard);
+                if (next[s] <= end[s]) {
+                    size_t want = end[s] - next[s] + 1 < SHIP_BATCH ? (size_t)(end[s] - next[s] + 1) : SHIP_BATCH;
+                    ssize_t bytes = pread(fileno(shard->journalPtr), entries, want * sizeof(struct journalEntry),
+                                          (off_t)((next[s] - 1) * sizeof(struct journalEntry)));
+                    size_t got = bytes > 0 ? (size_t)bytes / sizeof(struct journalEntry) : 0, count = 0, i;
+
+                    for (i = 0; i < got && entries[i].lsn == next[s]; i++, next[s]++) {
+                        memset(&frames[count], 0, sizeof(frames[count]));
+                        frames[count].kind = SHIP_ENTRY;
+                        frames[count].shard = (unsigned int)s;
+                        frames[count].end = end[s];
+                        frames[count].entry = entries[i];
+                        count++;
+                    }
+                    if (count == 0) {
+                        // a torn or old-format entry: the standby cannot apply past it
+                        fprintf(stderr, "i7: journal entry %llu of %s cannot be shipped\n", next[s], shard->fileName);
+                        matched = linked = 0;
+                        continue;
+                    }
+                    linked = shipSend(fd, frames, count);
+                    sent += count;
+                }
+            }
+            if (linked && sent == 0 && wallClockMs() - quiet >= SHIP_HEARTBEAT_MS) {
+                for (s = 0; s < store->shardCount; s++) {
+                    memset(&frames[s], 0, sizeof(frames[s]));
+                    frames[s].kind = SHIP_END;
+                    frames[s].shard = (unsigned int)s;
+                    frames[s].end = end[s];
+                }
+                linked = shipSend(fd, frames, store->shardCount);
+                sent = store->shardCount;
+            }
+            if (sent > 0) {
+                quiet = wallClockMs();
+            }
+
+            // take the acknowledgements that have come in, then wait for
+            // more of them or for new entries
+            while (linked && poll(&wait, 1, sent > 0 ? 0 : SHIP_POLL_MS) > 0) {
+                struct shipFrame ack;
+
+                linked = shipReceive(fd, &ack) && ack.kind == SHIP_ACK && ack.shard < store->shardCount;
+                if (linked) {
+                    acked[ack.shard] = ack.lsn;
+                    heard = wallClockMs();
+                }
+                sent = 1; // do not wait again this turn
+            }
+            for (s = 0; s < store->shardCount; s++) {
+                primaryLsn += end[s];
+                standbyLsn += acked[s];
+            }
+            writeReplication(statusFd, primaryLsn, standbyLsn, heard);
+        }
+        close(fd);
+        if (!serveStop && matched) {
+            fprintf(stderr, "i7: lost the standby at %s\n", address);
         }
     }
 
-    fclose(cfPtr); // fclose closes the file
-} // end main
+    if (statusFd >= 0) {
+        close(statusFd);
+    }
+    free(frames);
+    free(entries);
+    return matched;
+}
 
-// enable user to input menu choice
-unsigned int enterChoice(void)
-{
-    unsigned int menuChoice; // variable to store user's choice
-    // display available options
-    printf("%s", "\nEnter your choice\n"
-                 "1 - store a formatted text file of accounts called\n"
-                 "    \"accounts.txt\" for printing\n"
-                 "2 - update an account\n"
-                 "3 - add a new account\n"
-                 "4 - delete an account\n"
-                 "5 - sort accounts by balance or other criteria\n"  // NEW: Sort option
-                 "6 - end program\n? ");           // CHANGED: from 5 to 6
+// Standby side of journal shipping (i7 --standby ADDRESS, run next to
+// the standby's credit.dat, which starts as a copy of the primary's
+// store taken while no engine ran on it). Waits for the primary's
+// shipper, tells it the last journal entry applied on each shard, and
+// applies the entries it sends through the cache and journal like any
+// change, a batch per commit, so the standby's journal keeps the
+// primary's LSNs. Engines may read the standby store meanwhile (menu
+// exports and statistics, or i7 --serve for GETs) but must not change
+// it. To fail over, stop the standby with SIGTERM and run the engines on
+// its directory. Progress goes to credit.repl. Returns 0 if it could not
+// listen.
+int standby(struct recordStore *store, const char *address) {
+    unsigned long long end[MAX_SHARDS] = {0};
+    struct shipFrame frame;
+    char path[512];
+    int listener = serveListen(address), statusFd;
+    size_t s;
 
-    scanf("%u", &menuChoice); // receive choice from user
-    return menuChoice;
-} // end function enterChoice
+    if (listener < 0) {
+        return 0;
+    }
+    sidecarFileName(store->fileName, ".ship", path, sizeof(path));
+    unlink(path); // this store is a standby now
+    sidecarFileName(store->fileName, ".repl", path, sizeof(path));
+    statusFd = open(path, O_WRONLY | O_CREAT, 0644);
+    signal(SIGINT, serveSignal);
+    signal(SIGTERM, serveSignal);
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "i7: standby on %s\n", address);
 
-// create formatted text file for printing
-void textFile(FILE *readPtr)
-{
-    FILE *writePtr; // accounts.txt file pointer
-    int result;     // used to test whether fread read any bytes
-    // create clientData with default information
-    struct clientData client = {0, "", "", 0.0};
+    while (!serveStop) {
+        struct pollfd wait = {listener, POLLIN, 0};
+        int fd, linked = 1;
 
-    // fopen opens the file; exits if file cannot be opened
-    if ((writePtr = fopen("accounts.txt", "w")) == NULL)
-    {
-        puts("File could not be opened.");
-    } // end if
-    else
-    {
-        rewind(readPtr); // sets pointer to beginning of file
-        fprintf(writePtr, "%-6s%-16s%-11s%10s\n", "Acct", "Last Name", "First Name", "Balance");
+        if (poll(&wait, 1, SHIP_RETRY_MS) <= 0 || (fd = accept(listener, NULL, NULL)) < 0) {
+            continue;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        for (s = 0; s < store->shardCount && linked; s++) {
+            struct recordStore *shard = &store->shards[s];
 
-        // copy all records from random-access file into text file
-        while (!feof(readPtr))
-        {
-            result = fread(&client, sizeof(struct clientData), 1, readPtr);
+            if (shard->journalPtr != NULL) {
+                journalCatchUp(shard);
+            }
+            memset(&frame, 0, sizeof(frame));
+            frame.kind = SHIP_HELLO;
+            frame.shard = (unsigned int)s;
+            frame.lsn = shard->journalLsn;
+            frame.end = store->shardCount;
+            linked = shipSend(fd, &frame, 1);
+        }
 
-            // write single record to text file
-            if (result != 0 && client.acctNum != 0)
-            {
-                // Sanitize the data before writing to text file
-                sanitizeString(client.lastName, 15);
-                sanitizeString(client.firstName, 10);
-                fprintf(writePtr, "%-6d%-16s%-11s%10.2f\n", client.acctNum, client.lastName, client.firstName,
-                        client.balance);
-            } // end if
-        }     // end while
+        while (linked && !serveStop) {
+            struct pollfd ready = {fd, POLLIN, 0};
+            unsigned long long primaryLsn = 0, standbyLsn = 0;
+            size_t applied = 0;
 
-        fclose(writePtr); // fclose closes the file
-    }                     // end else
-} // end function textFile
+            if (poll(&ready, 1, SHIP_POLL_MS) <= 0) {
+                continue;
+            }
+            // apply what has arrived, up to a group's worth, then commit
+            // it and acknowledge
+            do {
+                struct recordStore *shard;
 
-// update balance in record
-void updateRecord(FILE *fPtr)
-{
-    unsigned int account; // account number
-    double transaction;   // transaction amount
-    // create clientData with no information
-    struct clientData client = {0, "", "", 0.0};
+                if (!(linked = shipReceive(fd, &frame)) || frame.shard >= store->shardCount) {
+                    linked = 0;
+                    break;
+                }
+                shard = &store->shards[frame.shard];
+                end[frame.shard] = frame.end;
+                if (frame.kind != SHIP_ENTRY || shard->journalPtr == NULL ||
+                    frame.entry.lsn <= shard->journalLsn + shard->pendingCount) {
+                    continue; // a heartbeat, or already applied
+                }
+                if (frame.entry.lsn != shard->journalLsn + shard->pendingCount + 1 ||
+                    shardOf(store, frame.entry.account) != shard) {
+                    fprintf(stderr, "i7: journal entry %llu of shard %u does not follow this store\n",
+                            frame.entry.lsn, frame.shard);
+                    linked = 0;
+                    break;
+                }
+                writeRecord(store, frame.entry.account, &frame.entry.record);
+                applied++;
+            } while (applied < GROUP_COMMIT_MAX && poll(&ready, 1, 0) > 0);
 
-    // obtain number of account to update
-    printf("%s", "Enter account to update ( 1 - 100 ): ");
-    scanf("%d", &account);
+            if (!commitRecords(store)) {
+                fprintf(stderr, "i7: the journal could not be written\n"); // retried with the next batch
+            }
+            for (s = 0; s < store->shardCount && linked; s++) {
+                memset(&frame, 0, sizeof(frame));
+                frame.kind = SHIP_ACK;
+                frame.shard = (unsigned int)s;
+                frame.lsn = store->shards[s].journalLsn;
+                linked = shipSend(fd, &frame, 1);
+                primaryLsn += end[s] > frame.lsn ? end[s] : frame.lsn;
+                standbyLsn += frame.lsn;
+            }
+            writeReplication(statusFd, primaryLsn, standbyLsn, wallClockMs());
+        }
+        close(fd);
+        if (!serveStop) {
+            fprintf(stderr, "i7: lost the primary\n");
+        }
+    }
 
-    // move file pointer to correct record in file
-    fseek(fPtr, (account - 1) * sizeof(struct clientData), SEEK_SET);
-    // read record from file
-    fread(&client, sizeof(struct clientData), 1, fPtr);
-    // display error if account does not exist
-    if (client.acctNum == 0)
-    {
-        printf("Account #%d has no information.\n", account);
+    close(listener);
+    if (statusFd >= 0) {
+        close(statusFd);
     }
-    else
-    { // update record
-        printf("%-6d%-16s%-11s%10.2f\n\n", client.acctNum, client.lastName, client.firstName, client.balance);
+    if (strspn(address, "0123456789") != strlen(address)) {
+        unlink(address);
+    }
+    return 1;
+}
 
-        // request transaction amount from user
-        printf("%s", "Enter charge ( + ) or payment ( - ): ");
-        scanf("%lf", &transaction);
-        client.balance += transaction; // update record balance
+#define FEED_BATCH 64        // changes formatted for a subscriber at a time
+#define FEED_LINE 128        // room for one CHANGE line
+#define FEED_MAX_CLIENTS 1024
+#define FEED_POLL_MS 10      // wait for new journal entries or subscribers
 
-        printf("%-6d%-16s%-11s%10.2f\n", client.acctNum, client.lastName, client.firstName, client.balance);
+// One connection to the change feed. A subscriber's position is the last
+// LSN it has been sent in each shard; changes are read from the journal
+// when its buffer is empty, so a slow subscriber falls behind in the
+// journal instead of in memory.
+struct feedClient {
+    int fd;
+    char in[SERVE_MAX_LINE];    // bytes received, not yet a whole line
+    size_t inUsed;
+    int subscribed;
+    int quitting;               // sent QUIT: close once the replies are out
+    unsigned long long position[MAX_SHARDS]; // last LSN sent, by shard
+    size_t nextShard;           // shard the next fill starts with
+    char out[FEED_BATCH * FEED_LINE];
+    size_t outUsed;
+    size_t outSent;
+}; // end structure feedClient
 
-        // move file pointer to correct record in file
-        // move back by 1 record length
-        fseek(fPtr, -sizeof(struct clientData), SEEK_CUR);
-        // write updated record over old record in file
-        fwrite(&client, sizeof(struct clientData), 1, fPtr);
-    } // end else
-} // end function updateRecord
+// queue a line for client (the buffer has room for a batch of changes
+// and the replies before them)
+void feedReply(struct feedClient *client, const char *format, ...) {
+    va_list args;
+    int length;
 
-// delete an existing record
-void deleteRecord(FILE *fPtr)
-{
-    struct clientData client;                       // stores record read from file
-    struct clientData blankClient = {0, "", "", 0}; // blank client
-    unsigned int accountNum;                        // account number
+    va_start(args, format);
+    length = vsnprintf(client->out + client->outUsed, sizeof(client->out) - client->outUsed - 1, format, args);
+    va_end(args);
+    if (length < 0 || (size_t)length >= sizeof(client->out) - client->outUsed - 1) {
+        return;
+    }
+    client->outUsed += (size_t)length;
+    client->out[client->outUsed++] = '\n';
+}
 
-    // obtain number of account to delete
-    printf("%s", "Enter account number to delete ( 1 - 100 ): ");
-    scanf("%d", &accountNum);
+// SUBSCRIBE <positions>: "now", or the last LSN seen in each shard,
+// comma-separated in shard order (0 = from the first change). Answers
+// "OK <shards> <positions now>"; returns 0 after an error reply.
+int feedSubscribe(struct recordStore *store, struct feedClient *client, const char *positions,
+                  const unsigned long long *end) {
+    char now[MAX_SHARDS * 21], *text = now;
+    size_t s;
 
-    // move file pointer to correct record in file
-    fseek(fPtr, (accountNum - 1) * sizeof(struct clientData), SEEK_SET);
-    // read record from file
-    fread(&client, sizeof(struct clientData), 1, fPtr);
-    // display error if record does not exist
-    if (client.acctNum == 0)
-    {
-        printf("Account %d does not exist.\n", accountNum);
-    } // end if
-    else
-    { // delete record
-        // move file pointer to correct record in file
-        fseek(fPtr, (accountNum - 1) * sizeof(struct clientData), SEEK_SET);
-        // replace existing record with blank record
-        fwrite(&blankClient, sizeof(struct clientData), 1, fPtr);
-    } // end else
-} // end function deleteRecord
+    for (s = 0; s < store->shardCount; s++) {
+        if (strcmp(positions, "now") == 0) {
+            client->position[s] = end[s];
+        } else {
+            char *after;
 
-// create and insert record
-void newRecord(FILE *fPtr)
-{
-    // create clientData with default information
-    struct clientData client = {0, "", "", 0.0};
-    unsigned int accountNum; // account number
+            client->position[s] = strtoull(positions, &after, 10);
+            if (after == positions || (*after != (s + 1 < store->shardCount ? ',' : '\0')) ||
+                client->position[s] > end[s]) {
+                feedReply(client, "ERR expected %zu comma-separated positions, none past the journal end",
+                          store->shardCount);
+                return 0;
+            }
+            positions = after + 1;
+        }
+        text += sprintf(text, s ? ",%llu" : "%llu", end[s]);
+    }
+    client->subscribed = 1;
+    feedReply(client, "OK %zu %s", store->shardCount, now);
+    return 1;
+}
 
-    // obtain number of account to create
-    printf("%s", "Enter new account number ( 1 - 100 ): ");
-    scanf("%d", &accountNum);
+// handle the whole request lines client has sent; 0 if it sent a line
+// too long to be a request
+int feedRequests(struct recordStore *store, struct feedClient *client, const unsigned long long *end) {
+    char *newline;
 
-    // move file pointer to correct record in file
-    fseek(fPtr, (accountNum - 1) * sizeof(struct clientData), SEEK_SET);
-    // read record from file
-    fread(&client, sizeof(struct clientData), 1, fPtr);
-    // display error if account already exists
-    if (client.acctNum != 0)
-    {
-        printf("Account #%d already contains information.\n", client.acctNum);
-    } // end if
-    else
-    { // create record
-        // user enters last name, first name and balance
-        printf("%s", "Enter lastname, firstname, balance\n? ");
-        scanf("%14s%9s%lf", client.lastName, client.firstName, &client.balance);
+    while ((newline = memchr(client->in, '\n', client->inUsed)) != NULL) {
+        char line[SERVE_MAX_LINE], command[16], positions[SERVE_MAX_LINE];
+        size_t length = (size_t)(newline - client->in);
 
-        client.acctNum = accountNum;
-        // move file pointer to correct record in file
-        fseek(fPtr, (client.acctNum - 1) * sizeof(struct clientData), SEEK_SET);
-        // insert record in file
-        fwrite(&client, sizeof(struct clientData), 1, fPtr);
-    } // end else
-} // end function newRecord
+        memcpy(line, client->in, length);
+        line[length] = '\0';
+        client->inUsed -= length + 1;
+        memmove(client->in, newline + 1, client->inUsed);
+        if (sscanf(line, "%15s", command) != 1 || client->subscribed || client->quitting) {
+            continue; // blank, or sent after subscribing or quitting
+        }
+        if (strcmp(command, "QUIT") == 0) {
+            client->quitting = 1;
+            continue;
+        }
+        if (strcmp(command, "SUBSCRIBE") != 0 || sscanf(line, "%*s %s", positions) != 1) {
+            feedReply(client, "ERR expected SUBSCRIBE <positions>");
+        } else {
+            feedSubscribe(store, client, positions, end);
+        }
+    }
+    if (client->inUsed == sizeof(client->in)) {
+        return 0; // a line too long for a request
+    }
+    return 1;
+}
 
-// Enhanced sortAccounts function with all features
-void sortAccounts(FILE *fPtr, int criterion, int ascending) {
-    struct clientData allAccounts[100];  // Array to hold all accounts from file
-    struct clientData validAccounts[100]; // Array to hold only valid accounts
-    int count = 0;
-    int i;
+// format the changes after client's positions, up to a batch, into its
+// empty buffer: from each shard in turn, so a busy shard does not hold
+// the others back
+void feedFill(struct recordStore *store, struct feedClient *client, const unsigned long long *end,
+              struct journalEntry *entries) {
+    static const char *const ops[] = {"?", "NEW", "UPDATE", "DELETE"};
+    size_t lines = 0, tried;
 
-    // Store the ascending order
-    ascending_order = ascending;
+    for (tried = 0; tried < store->shardCount && lines < FEED_BATCH; tried++) {
+        size_t s = (client->nextShard + tried) % store->shardCount;
+        struct recordStore *shard = &store->shards[s];
+        size_t want, got, i;
+        ssize_t bytes;
 
-    // Read all accounts from file
-    rewind(fPtr);
-    for (i = 0; i < 100; i++) {
-        fread(&allAccounts[i], sizeof(struct clientData), 1, fPtr);
-    }
+        if (client->position[s] >= end[s]) {
+            continue;
+        }
+        want = end[s] - client->position[s] < FEED_BATCH - lines ? (size_t)(end[s] - client->position[s])
+                                                                  : FEED_BATCH - lines;
+        bytes = pread(fileno(shard->journalPtr), entries, want * sizeof(struct journalEntry),
+                      (off_t)(client->position[s] * sizeof(struct journalEntry)));
+        got = bytes > 0 ? (size_t)bytes / sizeof(struct journalEntry) : 0;
+        for (i = 0; i < got && entries[i].lsn == client->position[s] + 1; i++) {
+            char oldAmount[24], newAmount[24];
 
-    // Extract only valid accounts (acctNum != 0 and within valid range)
-    for (i = 0; i < 100; i++) {
-        if (allAccounts[i].acctNum != 0 && 
-            allAccounts[i].acctNum >= 1 && 
-            allAccounts[i].acctNum <= 100 &&
-            allAccounts[i].balance >= -1000000.0 && 
-            allAccounts[i].balance <= 10000000.0) {
-            
-            // Sanitize the names to ensure they are clean
-            sanitizeString(allAccounts[i].lastName, 15);
-            sanitizeString(allAccounts[i].firstName, 10);
-            validAccounts[count] = allAccounts[i];
-            count++;
+            client->position[s]++;
+            feedReply(client, "CHANGE %zu %llu %s %u %s %s", s, entries[i].lsn, ops[entries[i].op <= 3 ? entries[i].op : 0],
+                      entries[i].account, formatCents(entries[i].oldBalance, oldAmount),
+                      formatCents(entries[i].record.balance, newAmount));
+            lines++;
         }
     }
+    client->nextShard = (client->nextShard + 1) % store->shardCount;
+}
 
-    if (count == 0) {
-        printf("No accounts found.\n");
-        return;
+// Publish every committed change on address (i7 --feed ADDRESS, run next
+// to credit.dat) until SIGINT or SIGTERM. A subscriber sends
+//   SUBSCRIBE now | SUBSCRIBE <lsn>[,<lsn>...]
+// and is answered "OK <shards> <positions>", then sent
+//   CHANGE <shard> <lsn> <NEW|UPDATE|DELETE> <account> <old balance> <new balance>
+// for each change after its positions, in LSN order within a shard, as
+// they are committed. The journal is never cut, so a subscriber that
+// keeps the LSN of the last change it handled in each shard can resume
+// from there at any time. Returns 0 if the store has no journal or the
+// address cannot be listened on.
+int feed(struct recordStore *store, const char *address) {
+    struct feedClient **clients = calloc(FEED_MAX_CLIENTS, sizeof(struct feedClient *));
+    struct pollfd *waits = calloc(FEED_MAX_CLIENTS + 1, sizeof(struct pollfd));
+    struct journalEntry *entries = malloc(FEED_BATCH * sizeof(struct journalEntry));
+    unsigned long long end[MAX_SHARDS];
+    size_t count = 0, i, s;
+    int listener = -1;
+
+    for (s = 0; s < store->shardCount; s++) {
+        if (store->shards[s].journalPtr == NULL) {
+            count = 1; // nothing to publish
+        }
+    }
+    if (count != 0 || clients == NULL || waits == NULL || entries == NULL || (listener = serveListen(address)) < 0) {
+        free(clients);
+        free(waits);
+        free(entries);
+        return 0;
     }
+    signal(SIGINT, serveSignal);
+    signal(SIGTERM, serveSignal);
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "i7: change feed on %s\n", address);
 
-    // Perform the sorting based on the criterion
-    switch (criterion) {
-        case 1:  // Sort by Balance
-            qsort(validAccounts, count, sizeof(struct clientData), compareByBalance);
-            break;
-        case 2:  // Sort by Last Name and First Name
-            qsort(validAccounts, count, sizeof(struct clientData), compareByName);
-            break;
-        case 3:  // Show Account with Maximum Balance
-            {
-                struct clientData *maxBalance = &validAccounts[0];
-                for (i = 1; i < count; i++) {
-                    if (validAccounts[i].balance > maxBalance->balance) {
-                        maxBalance = &validAccounts[i];
-                    }
+    while (!serveStop) {
+        for (s = 0; s < store->shardCount; s++) {
+            end[s] = journalCommitted(&store->shards[s]);
+        }
+
+        // new subscribers, requests, and changes for subscribers whose
+        // buffers have drained
+        for (i = 0; i < count; i++) {
+            struct feedClient *client = clients[i];
+            int open = 1;
+
+            if (waits[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+                ssize_t got = recv(client->fd, client->in + client->inUsed, sizeof(client->in) - client->inUsed, 0);
+
+                if (got > 0) {
+                    client->inUsed += (size_t)got;
+                    open = feedRequests(store, client, end);
+                } else if (got == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    open = 0;
                 }
-                printf("\n%-6s%-16s%-11s%-15s\n", "Acct", "Last Name", "First Name", "Balance");
-                printf("====================================================\n");
-                printf("Account with MAXIMUM balance:\n");
-                printf("%-6d%-16s%-11s%-15.2f\n",
-                    maxBalance->acctNum, maxBalance->lastName, maxBalance->firstName, maxBalance->balance);
-                return;
             }
-        case 4:  // Show Account with Minimum Balance
-            {
-                struct clientData *minBalance = &validAccounts[0];
-                for (i = 1; i < count; i++) {
-                    if (validAccounts[i].balance < minBalance->balance) {
-                        minBalance = &validAccounts[i];
-                    }
+            if (open && client->subscribed && client->outSent == client->outUsed) {
+                client->outUsed = client->outSent = 0;
+                feedFill(store, client, end, entries);
+            }
+            while (open && client->outSent < client->outUsed) {
+                ssize_t n = send(client->fd, client->out + client->outSent, client->outUsed - client->outSent,
+                                 MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) {
+                    continue;
                 }
-                printf("\n%-6s%-16s%-11s%-15s\n", "Acct", "Last Name", "First Name", "Balance");
-                printf("====================================================\n");
-                printf("Account with MINIMUM balance:\n");
-                printf("%-6d%-16s%-11s%-15.2f\n",
-                    minBalance->acctNum, minBalance->lastName, minBalance->firstName, minBalance->balance);
-                return;
+                if (n < 0) {
+                    open = errno == EAGAIN || errno == EWOULDBLOCK; // the socket is full: later
+                    break;
+                }
+                client->outSent += (size_t)n;
             }
-        default:
-            printf("Invalid sorting criterion!\n");
-            return;
+            if (client->quitting && client->outSent == client->outUsed) {
+                open = 0;
+            }
+            if (!open) {
+                close(client->fd);
+                free(client);
+                clients[i--] = clients[--count];
+                waits[i + 2] = waits[count + 1]; // keep the moved client's events
+            }
+        }
+
+        waits[0].fd = listener;
+        waits[0].events = POLLIN;
+        for (i = 0; i < count; i++) {
+            waits[i + 1].fd = clients[i]->fd;
+            waits[i + 1].events = POLLIN | (clients[i]->outSent < clients[i]->outUsed ? POLLOUT : 0);
+        }
+        if (poll(waits, count + 1, FEED_POLL_MS) > 0 && (waits[0].revents & POLLIN)) {
+            int fd;
+
+            while ((fd = accept(listener, NULL, NULL)) >= 0) {
+                struct feedClient *client;
+
+                if (count == FEED_MAX_CLIENTS || fcntl(fd, F_SETFL, O_NONBLOCK) != 0 ||
+                    (client = calloc(1, sizeof(struct feedClient))) == NULL) {
+                    close(fd);
+                    continue;
+                }
+                client->fd = fd;
+                clients[count] = client;
+                waits[count + 1].revents = 0; // heard from next turn
+                count++;
+            }
+        }
     }
 
-    // Print sorted accounts with proper alignment (only for cases 1 and 2)
-    printf("\n%-6s%-16s%-11s%-15s\n", "Acct", "Last Name", "First Name", "Balance");
-    printf("====================================================\n");
     for (i = 0; i < count; i++) {
-        printf("%-6d%-16s%-11s%-15.2f\n", 
-               validAccounts[i].acctNum, 
-               validAccounts[i].lastName, 
-               validAccounts[i].firstName,
-               validAccounts[i].balance);
+        close(clients[i]->fd);
+        free(clients[i]);
     }
-}
\ No newline at end of file
+    close(listener);
+    if (strspn(address, "0123456789") != strlen(address)) {
+        unlink(address);
+    }
+    free(clients);
+    free(waits);
+    free(entries);
+    return 1;
+}
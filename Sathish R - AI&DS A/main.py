@@ -1,15 +1,156 @@
 from flask import Flask, request, jsonify
 import subprocess
 import os
+import socket
 import struct
+import itertools
+import fcntl
+import json
+import mmap
+import threading
 
 app = Flask(__name__)
 
+# marks a credit.dat record whose balance is stored as int64 cents (see i7.c)
+CENTS_TAG = b"\xc2\xa2\x02"
+# version 2 credit.dat: 32-byte header, then 16-byte records whose names
+# are "last\0first\0" at an offset into credit.names
+FILE_MAGIC = b"I7BANK\r\n"
+FILE_HEADER = struct.Struct("8sIIQII")
+PACKED_RECORD = struct.Struct("IIq")
+# read-only engines (i7 --replica ADDRESS) that listings, searches and
+# sorted pages go to: comma-separated socket paths or loopback ports
+REPLICAS_ENV = "I7_REPLICAS"
+REPLICA_TIMEOUT = 5
+# a credit.jnl entry (struct journalEntry in i7.c); the journal only
+# grows, so its length in entries counts the changes to the store
+JOURNAL_ENTRY = struct.Struct("QIIqI32s24sq")
+RESPONSE_CACHE_SIZE = 64
+# the engine's change feed (i7 --feed ADDRESS), for /api/changes
+FEED_ENV = "I7_FEED"
+FEED_IDLE = 15  # seconds between keep-alives on a quiet feed
+# streamed listings: records read from a file, replica rows asked for and
+# accounts sent per chunk of the response
+STREAM_CHUNK = 1000
+# the engine's V6 bounds (MIN_VALID_BALANCE, MAX_VALID_BALANCE in i7.c)
+MIN_VALID_BALANCE = -1000000.0
+MAX_VALID_BALANCE = 10000000.0
+
 class CBankInterface:
     def __init__(self, c_program_path="./i7"):
         
         self.c_program_path = c_program_path
         self.data_file = "credit.dat"
+        self.names_file = "credit.names"
+        self.shards_file = "credit.shards"
+        self.replicas = [a.strip() for a in os.environ.get(REPLICAS_ENV, "").split(",") if a.strip()]
+        self.replica_turn = itertools.count()
+        self.feed = os.environ.get(FEED_ENV, "").strip()
+
+    def connect_engine(self, address, timeout):
+        """Socket to an engine listening on a Unix socket path or a loopback port"""
+        if address.isdigit():
+            return socket.create_connection(("127.0.0.1", int(address)), timeout=timeout)
+        conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        conn.settimeout(timeout)
+        try:
+            conn.connect(address)
+        except OSError:
+            conn.close()
+            raise
+        return conn
+
+    def feed_lines(self, conn):
+        """Split lines from the change feed; None whenever it is quiet for
+        FEED_IDLE seconds"""
+        buffer = b""
+        while True:
+            while b"\n" not in buffer:
+                try:
+                    data = conn.recv(65536)
+                except socket.timeout:
+                    yield None
+                    continue
+                if not data:
+                    return
+                buffer += data
+            line, buffer = buffer.split(b"\n", 1)
+            yield line.decode("utf-8", errors="ignore").split()
+
+    def subscribe_changes(self, start):
+        """Subscribe to the change feed after start ("now", or the last LSN
+        seen in each shard, comma-separated). Returns the feed positions at
+        that moment and a generator of (position after the change, change),
+        which also gives None whenever the feed is quiet for a while."""
+        conn = self.connect_engine(self.feed, FEED_IDLE)
+        lines = self.feed_lines(conn)
+        try:
+            conn.sendall(f"SUBSCRIBE {start}\n".encode())
+            reply = next(lines, None)
+        except OSError:
+            conn.close()
+            raise
+        if not reply or reply[0] != "OK":
+            conn.close()
+            raise ValueError(" ".join(reply or ["no answer from the change feed"]))
+        positions = (reply[2] if start == "now" else start).split(",")
+
+        def changes():
+            with conn:
+                for parts in lines:
+                    if parts is None:
+                        yield None
+                    elif len(parts) == 7 and parts[0] == "CHANGE":
+                        positions[int(parts[1])] = parts[2]
+                        yield ",".join(positions), {
+                            'shard': int(parts[1]),
+                            'lsn': int(parts[2]),
+                            'op': parts[3],
+                            'acct_num': int(parts[4]),
+                            'old_balance': float(parts[5]),
+                            'new_balance': float(parts[6])
+                        }
+
+        return ",".join(positions), changes()
+
+    def call_replica(self, request):
+        """Send one listing request to the next replica in turn and return
+        (row fields, END fields), or None if no replica answered"""
+        for _ in range(len(self.replicas)):
+            address = self.replicas[next(self.replica_turn) % len(self.replicas)]
+            try:
+                conn = self.connect_engine(address, REPLICA_TIMEOUT)
+                with conn, conn.makefile("rw", encoding="utf-8", newline="\n") as stream:
+                    stream.write(request + "\n")
+                    stream.flush()
+                    rows = []
+                    for line in stream:
+                        parts = line.split()
+                        if parts[:1] == ["ROW"]:
+                            rows.append(parts[1:])
+                        elif parts[:1] == ["END"]:
+                            return rows, parts[1:]
+                        else:
+                            print(f"Replica {address}: {line.strip()}")
+                            return None
+            except OSError as e:
+                print(f"Replica {address} unavailable: {e}")
+        return None
+
+    def replica_accounts(self, rows):
+        """Account dicts from replica rows of account, last, first, balance"""
+        accounts = []
+        for parts in rows:
+            try:
+                accounts.append({
+                    'acct_num': int(parts[0]),
+                    'last_name': parts[1],
+                    'first_name': parts[2],
+                    'balance': float(parts[3])
+                })
+            except (ValueError, IndexError):
+                continue
+        return accounts
 
     def call_c_program(self, choice, input_data=""):
         """Call the C program with proper input handling and encoding"""
@@ -68,17 +209,112 @@ class CBankInterface:
             print(f"Error calling C program: {e}")
             return {"success": False, "output": "", "error": str(e)}
 
+    def read_packed_record(self, data, names):
+        """Fields of one version 2 record, names looked up in the name heap"""
+        acct_num, name_ref, cents = PACKED_RECORD.unpack(data)
+        last_end = names.find(b"\0", name_ref)
+        first_end = names.find(b"\0", last_end + 1)
+        if acct_num == 0 or last_end < 0 or first_end < 0:
+            return acct_num, b"", b"", 0.0
+        return acct_num, names[name_ref:last_end], names[last_end + 1:first_end], cents / 100.0
+
+    def read_plain_record(self, data):
+        """Fields of one version 1 record (40 bytes, names inline)"""
+        acct_num, last_name_bytes, first_name_bytes, tag = struct.unpack("I15s10s3s", data[:32])
+        # tagged records hold int64 cents, older ones a double
+        if tag == CENTS_TAG:
+            balance = struct.unpack("q", data[32:])[0] / 100.0
+        else:
+            balance = round(struct.unpack("d", data[32:])[0], 2)
+        return acct_num, last_name_bytes, first_name_bytes, balance
+
+    def clean_name(self, name_bytes):
+        """Printable text of a stored name (V6 sanitization)"""
+        name = name_bytes.decode('utf-8', errors='ignore').rstrip('\x00').strip()
+        return ''.join(c for c in name if c.isprintable())
+
+    def data_files(self):
+        """(records, names) file pairs of the store: the shard files when
+        credit.shards says it was split (see i7 --shard), else credit.dat"""
+        try:
+            with open(self.shards_file) as f:
+                count = int(f.read().split()[0])
+        except (OSError, ValueError, IndexError):
+            count = 0
+        if count > 1:
+            return [(f"credit.s{i}.dat", f"credit.s{i}.names") for i in range(count)]
+        return [(self.data_file, self.names_file)]
+
+    def store_version(self):
+        """The store's change counter as i7 computes it (storeVersion): the
+        committed journal entries of every shard, each journal's length read
+        under its shared lock so no entry counted is still being written.
+        Prefixed with the shard count, as splitting the store starts new
+        journals. None if there is no journal to count."""
+        files = self.data_files()
+        total = 0
+        for data_file, _ in files:
+            try:
+                with open(os.path.splitext(data_file)[0] + ".jnl", "rb") as journal:
+                    fcntl.flock(journal, fcntl.LOCK_SH)
+                    total += os.fstat(journal.fileno()).st_size // JOURNAL_ENTRY.size
+            except OSError:
+                return None
+        return f"{len(files)}.{total}"
+
+    def response_version(self):
+        """The store version responses are cached and tagged under, or None
+        to build every response afresh. Replicas answer from their own copy,
+        which lags the primary's journal by an unknown amount, so with
+        replicas configured a body is never filed under the primary's
+        version."""
+        return None if self.replicas else self.store_version()
+
+    def list_accounts(self):
+        """Accounts 1-100 from a replica when one is configured, else from the file"""
+        answer = self.call_replica("LIST 0 100") if self.replicas else None
+        if answer is None:
+            return self.read_accounts_from_file()
+        return [a for a in self.replica_accounts(answer[0]) if a['acct_num'] <= 100]
+
+    def search_accounts(self, prefix, after, limit):
+        """Accounts after the cursor whose last names start with prefix, and
+        the cursor to continue from (0 when there are no more)"""
+        answer = self.call_replica(f"SEARCH {prefix} {after} {limit}") if self.replicas else None
+        if answer is not None:
+            return self.replica_accounts(answer[0]), int(answer[1][0])
+        matches = [a for a in self.read_accounts_from_file()
+                   if a['acct_num'] > after and a['last_name'].startswith(prefix)]
+        cursor = matches[limit - 1]['acct_num'] if len(matches) > limit else 0
+        return matches[:limit], cursor
+
     def read_accounts_from_file(self):
         """Read accounts directly from binary file with V6 validation"""
         accounts = []
         try:
-            if os.path.exists(self.data_file):
-                with open(self.data_file, "rb") as f:
+            for data_file, names_file in self.data_files():
+                if not os.path.exists(data_file):
+                    continue
+                with open(data_file, "rb") as f:
+                    names = None
+                    record_size = 40
+                    if f.read(len(FILE_MAGIC)) == FILE_MAGIC:
+                        f.seek(FILE_HEADER.size)
+                        record_size = PACKED_RECORD.size
+                        with open(names_file, "rb") as heap:
+                            names = heap.read()
+                    else:
+                        f.seek(0)
                     for i in range(100):
-                        data = f.read(40)  # 40 bytes per record
-                        if len(data) == 40:
+                        data = f.read(record_size)
+                        if len(data) == record_size:
                             try:
-                                acct_num, last_name_bytes, first_name_bytes, balance = struct.unpack("I15s10sd", data)
+                                if names is not None:
+                                    acct_num, last_name_bytes, first_name_bytes, balance = \
+                                        self.read_packed_record(data, names)
+                                else:
+                                    acct_num, last_name_bytes, first_name_bytes, balance = \
+                                        self.read_plain_record(data)
 
                                 # V6 validation: valid account number and reasonable balance
                                 if (acct_num != 0 and 
@@ -87,12 +323,8 @@ class CBankInterface:
                                     balance >= -1000000.0 and 
                                     balance <= 10000000.0):
 
-                                    last_name = last_name_bytes.decode('utf-8', errors='ignore').rstrip('\x00').strip()
-                                    first_name = first_name_bytes.decode('utf-8', errors='ignore').rstrip('\x00').strip()
-
-                                    # Clean non-printable characters (V6 sanitization)
-                                    last_name = ''.join(c for c in last_name if c.isprintable())
-                                    first_name = ''.join(c for c in first_name if c.isprintable())
+                                    last_name = self.clean_name(last_name_bytes)
+                                    first_name = self.clean_name(first_name_bytes)
 
                                     if last_name and first_name:
                                         accounts.append({
@@ -107,21 +339,99 @@ class CBankInterface:
                         else:
                             break
 
-                print(f"Total valid accounts found: {len(accounts)}")
+            # shards hold every Nth account, so put them back in order
+            accounts.sort(key=lambda account: account['acct_num'])
+            print(f"Total valid accounts found: {len(accounts)}")
 
         except Exception as e:
             print(f"Error reading accounts: {e}")
 
         return accounts
 
+    def iter_file_records(self, data_file, names_file, slot):
+        """Records of one record file from slot on, read STREAM_CHUNK at a
+        time; the name heap is mapped rather than read"""
+        if not os.path.exists(data_file):
+            return
+        with open(data_file, "rb") as f:
+            names = None
+            offset = 0
+            record_size = 40
+            if f.read(len(FILE_MAGIC)) == FILE_MAGIC:
+                offset = FILE_HEADER.size
+                record_size = PACKED_RECORD.size
+                with open(names_file, "rb") as heap:
+                    if os.fstat(heap.fileno()).st_size > 0:
+                        names = mmap.mmap(heap.fileno(), 0, access=mmap.ACCESS_READ)
+                    else:
+                        names = b""
+            try:
+                f.seek(offset + slot * record_size)
+                while True:
+                    chunk = f.read(record_size * STREAM_CHUNK)
+                    for start in range(0, len(chunk) - record_size + 1, record_size):
+                        data = chunk[start:start + record_size]
+                        try:
+                            if names is not None:
+                                yield self.read_packed_record(data, names)
+                            else:
+                                yield self.read_plain_record(data)
+                        except struct.error:
+                            yield 0, b"", b"", 0.0
+                    if len(chunk) < record_size * STREAM_CHUNK:
+                        return
+            finally:
+                if isinstance(names, mmap.mmap):
+                    names.close()
+
+    def iter_file_accounts(self, after=0):
+        """Valid accounts after the cursor, in account order, straight from
+        the record files: account a sits in slot a - 1, or in shard
+        (a - 1) % n at slot (a - 1) // n, so the cursor is a seek"""
+        files = self.data_files()
+        count = len(files)
+        readers = [self.iter_file_records(data_file, names_file, max(0, -(-(after - i) // count)))
+                   for i, (data_file, names_file) in enumerate(files)]
+        account = after + 1
+        while any(reader is not None for reader in readers):
+            shard = (account - 1) % count
+            record = next(readers[shard], None) if readers[shard] is not None else None
+            if record is None:
+                readers[shard] = None  # this shard's file has ended
+            else:
+                acct_num, last_name_bytes, first_name_bytes, balance = record
+                if acct_num == account and MIN_VALID_BALANCE <= balance <= MAX_VALID_BALANCE:
+                    yield {
+                        'acct_num': acct_num,
+                        'last_name': self.clean_name(last_name_bytes),
+                        'first_name': self.clean_name(first_name_bytes),
+                        'balance': balance
+                    }
+            account += 1
+
+    def iter_accounts(self, after=0):
+        """Valid accounts after the cursor in account order, from the replicas
+        a page at a time when there are any, else from the files; memory use
+        does not grow with the store"""
+        while self.replicas:
+            answer = self.call_replica(f"LIST {after} {STREAM_CHUNK}")
+            if answer is None:
+                break  # go on from the files, where the replica stopped
+            for account in self.replica_accounts(answer[0]):
+                after = account['acct_num']
+                yield account
+            if int(answer[1][0]) == 0:
+                return
+        yield from self.iter_file_accounts(after)
+
     def add_account(self, account_num, last_name, first_name, balance):
         """Add a new account via C program"""
-        input_data = f"{account_num}\n{last_name} {first_name} {balance}"
+        input_data = f"{account_num}\n{last_name} {first_name} {float(balance):.2f}"
         return self.call_c_program("3", input_data)
 
     def update_account(self, account_num, transaction):
         """Update account balance via C program"""
-        input_data = f"{account_num}\n{transaction}"
+        input_data = f"{account_num}\n{float(transaction):.2f}"
         return self.call_c_program("2", input_data)
 
     def delete_account(self, account_num):
@@ -138,9 +448,115 @@ class CBankInterface:
         input_data = f"{criterion}\n{order}"
         return self.call_c_program("5", input_data)
 
+    def sort_page(self, criterion, order, offset, limit):
+        """One page of a sorted listing as structured rows (rank, account, names, balance)"""
+        answer = self.call_replica(f"PAGE {criterion} {order} {offset} {limit}") if self.replicas else None
+        if answer is not None:
+            rows = []
+            for parts in answer[0]:
+                for account in self.replica_accounts([parts[1:]]):
+                    account['rank'] = int(parts[0])
+                    rows.append(account)
+            return {"success": True, "accounts": rows, "total": int(answer[1][0])}
+        result = self.call_c_program("9", f"{criterion} {order} {offset} {limit}")
+        rows = []
+        total = None
+        for line in result['output'].split('\n'):
+            parts = line.split()
+            if parts[:1] == ['page:'] and len(parts) == 4:
+                total = int(parts[3])
+            elif len(parts) == 5 and parts[0].isdigit() and parts[1].isdigit():
+                try:
+                    rows.append({
+                        'rank': int(parts[0]),
+                        'acct_num': int(parts[1]),
+                        'last_name': parts[2],
+                        'first_name': parts[3],
+                        'balance': float(parts[4])
+                    })
+                except ValueError:
+                    continue
+        return {"success": result['success'] and total is not None, "accounts": rows, "total": total or 0}
+
+    def aggregate(self, min_balance="*", max_balance="*", prefix="*", buckets=10):
+        """Sum, count, mean, min, max, percentiles and histogram in one C call"""
+        input_data = f"{min_balance} {max_balance} {prefix} {buckets}"
+        result = self.call_c_program("8", input_data)
+        summary = {}
+        histogram = []
+        for line in result['output'].split('\n'):
+            name, sep, value = line.partition(':')
+            name = name.strip().rsplit('? ', 1)[-1]
+            if not sep or ' ' in name:
+                continue
+            try:
+                if name == 'bucket':
+                    low, high, count = value.split()
+                    histogram.append({'low': float(low), 'high': float(high), 'count': int(count)})
+                elif name == 'count':
+                    summary[name] = int(value)
+                elif name in ('sum', 'mean', 'min', 'max', 'p50', 'p90', 'p99'):
+                    summary[name] = float(value)
+            except ValueError:
+                continue
+        return {"success": result['success'] and 'count' in summary,
+                "aggregate": summary, "histogram": histogram}
+
+    def get_stats(self):
+        """Read engine statistics ("name: value" lines) via C program"""
+        result = self.call_c_program("7")
+        stats = {}
+        for line in result['output'].split('\n'):
+            name, sep, value = line.partition(':')
+            if sep and name.strip() and ' ' not in name.strip():
+                try:
+                    stats[name.strip()] = float(value) if '.' in value else int(value)
+                except ValueError:
+                    continue
+        return {"success": result['success'], "stats": stats}
+
 # Initialize the interface
 bank = CBankInterface()
 
+# serialized responses by (endpoint, parameters): (store version, JSON)
+response_cache = {}
+response_cache_lock = threading.Lock()
+
+def not_modified(version):
+    """304 for a client whose copy is of this store version"""
+    response = app.response_class(status=304)
+    response.set_etag(version)
+    return response
+
+def cached_response(key, build):
+    """Answer with build()'s result, built at most once per store version.
+    The version is read before building, so no cached body is older than
+    the version it is filed under. GET responses carry the version as their
+    ETag, and a matching If-None-Match gets 304 without any work."""
+    version = bank.response_version()
+    if version is None:
+        return jsonify(build())
+    if request.method == 'GET' and request.if_none_match.contains(version):
+        return not_modified(version)
+
+    with response_cache_lock:
+        cached = response_cache.get(key)
+    if cached is not None and cached[0] == version:
+        body = cached[1]
+    else:
+        result = build()
+        body = json.dumps(result)
+        if result.get('success'):
+            with response_cache_lock:
+                if key not in response_cache and len(response_cache) >= RESPONSE_CACHE_SIZE:
+                    del response_cache[next(iter(response_cache))]  # the oldest entry
+                response_cache[key] = (version, body)
+
+    response = app.response_class(body, mimetype='application/json')
+    if request.method == 'GET':
+        response.set_etag(version)
+    return response
+
 @app.route('/')
 def index():
     return '''<!DOCTYPE html>
@@ -380,7 +796,9 @@ def index():
                 4: { 1: 'Minimum Balance Account' }
             };
 
-            const result = await apiCall('/api/accounts/sort', 'POST', { criterion, order });
+            // sorted listings ask the engine for the first page only
+            const request = (criterion === 1 || criterion === 2) ? { criterion, order, offset: 0, limit: 100 } : { criterion, order };
+            const result = await apiCall('/api/accounts/sort', 'POST', request);
 
             if (result.success) {
                 let content = '';
@@ -403,7 +821,7 @@ def index():
                     if (result.accounts && result.accounts.length > 0) {
                         result.accounts.forEach((account, index) => {
                             content += `<div class="account-item">
-                                <div><span class="rank-badge">#${index + 1}</span></div>
+                                <div><span class="rank-badge">#${account.rank || index + 1}</span></div>
                                 <div>${account.acct_num}</div>
                                 <div>${account.last_name}</div>
                                 <div>${account.first_name}</div>
@@ -534,12 +952,72 @@ def index():
 
 # API Routes for V6 functionality
 
+def stream_accounts(after, limit):
+    """Accounts after the cursor as one JSON document sent in chunks while
+    the store is read, so the first bytes leave at once and memory stays
+    flat. "next_after" is the cursor for the following page (0 when there
+    is none); "success" comes last, as only the end of the read knows it."""
+    version = bank.response_version()
+    if version is not None and request.if_none_match.contains(version):
+        return not_modified(version)
+
+    def generate():
+        yield '{"accounts": ['
+        sent = last = cursor = 0
+        chunk = []
+        try:
+            for account in bank.iter_accounts(after):
+                if sent == limit:
+                    cursor = last  # there is more after this page
+                    break
+                chunk.append(json.dumps(account))
+                sent += 1
+                last = account['acct_num']
+                if len(chunk) == STREAM_CHUNK:
+                    yield ("" if sent == len(chunk) else ", ") + ", ".join(chunk)
+                    chunk = []
+            if chunk:
+                yield ("" if sent == len(chunk) else ", ") + ", ".join(chunk)
+            yield f'], "next_after": {cursor}, "success": true}}'
+        except Exception as e:
+            print(f"Error streaming accounts: {e}")
+            yield f'], "next_after": 0, "success": false, "message": {json.dumps(str(e))}}}'
+
+    response = app.response_class(generate(), mimetype='application/json')
+    if version is not None:
+        response.set_etag(version)
+    return response
+
 @app.route('/api/accounts', methods=['GET'])
 def get_accounts():
-    """Get all accounts with V6 validation"""
+    """Get all accounts with V6 validation. With ?after= and/or ?limit= the
+    whole book is listed instead, streamed a page at a time from the cursor."""
     try:
-        accounts = bank.read_accounts_from_file()
-        return jsonify({"success": True, "accounts": accounts})
+        if 'after' in request.args or 'limit' in request.args:
+            after = int(request.args.get('after', 0))
+            limit = int(request.args['limit']) if 'limit' in request.args else None
+            if after < 0 or (limit is not None and limit < 1):
+                return jsonify({"success": False, "message": "after must be >= 0 and limit >= 1", "accounts": []})
+            return stream_accounts(after, limit)
+        return cached_response(('accounts',), lambda: {"success": True, "accounts": bank.list_accounts()})
+    except Exception as e:
+        return jsonify({"success": False, "message": str(e), "accounts": []})
+
+@app.route('/api/accounts/search', methods=['GET'])
+def search_accounts():
+    """Accounts by last name prefix, a page at a time (?prefix=&after=&limit=)"""
+    try:
+        prefix = request.args.get('prefix', '').strip()
+        after = int(request.args.get('after', 0))
+        limit = int(request.args.get('limit', 100))
+        if not prefix.isalnum() or after < 0 or limit < 1:
+            return jsonify({"success": False, "message": "Need a letters-or-digits prefix, after >= 0 and limit >= 1", "accounts": []})
+        def search():
+            accounts, cursor = bank.search_accounts(prefix, after, limit)
+            return {"success": True, "accounts": accounts, "next_after": cursor}
+        return cached_response(('search', prefix, after, limit), search)
+    except ValueError:
+        return jsonify({"success": False, "message": "Invalid input values", "accounts": []})
     except Exception as e:
         return jsonify({"success": False, "message": str(e), "accounts": []})
 
@@ -630,59 +1108,40 @@ def export_accounts():
     except Exception as e:
         return jsonify({"success": False, "message": str(e)})
 
-@app.route('/api/accounts/sort', methods=['POST'])
-def sort_accounts():
-    """Enhanced V6 sorting with all 4 options"""
-    try:
-        data = request.get_json()
-        criterion = int(data['criterion'])  # 1=Balance, 2=Name, 3=Max, 4=Min
-        order = int(data['order'])          # 1=Ascending, 2=Descending
-
-        print(f"=== V6 SORT: Criterion {criterion}, Order {order} ===")
-
-        result = bank.sort_accounts(criterion, order)
-
-        if result['success']:
-            lines = result['output'].split('\n')
-
-            # Handle Max/Min Balance (criterion 3 or 4)
-            if criterion == 3 or criterion == 4:
-                for line in lines:
-                    line = line.strip()
-                    if line and not any(x in line for x in ['Enter your choice', 'Choose', 'Acct', '====', '?']):
-                        parts = line.split()
-                        if len(parts) >= 4:
-                            try:
-                                acct_num = int(parts[0])
-                                if 1 <= acct_num <= 100:  # Valid account number
-                                    last_name = parts[1]
-                                    first_name = parts[2]
-                                    balance = float(parts[3])
-
-                                    return jsonify({
-                                        "success": True,
-                                        "message": f"{'Maximum' if criterion == 3 else 'Minimum'} balance account found",
-                                        "account": {
-                                            'acct_num': acct_num,
-                                            'last_name': last_name,
-                                            'first_name': first_name,
-                                            'balance': balance
-                                        }
-                                    })
-                            except (ValueError, IndexError):
-                                continue
-
-                return jsonify({"success": False, "message": "No valid account found for min/max"})
+def sort_result(criterion, order, data):
+    """Result of a sort request as a dict, for sort_accounts to cache"""
+    # Paged listing: only offset..offset+limit is selected by the engine
+    if 'limit' in data and criterion in (1, 2):
+        offset = int(data.get('offset', 0))
+        limit = int(data['limit'])
+        if offset < 0 or limit < 1:
+            return {"success": False, "message": "offset must be >= 0 and limit >= 1"}
+
+        page = bank.sort_page(criterion, order, offset, limit)
+        if not page['success']:
+            return {"success": False, "message": "Sort failed"}
+
+        sort_type = "Balance" if criterion == 1 else "Name"
+        sort_order = "Ascending" if order == 1 else "Descending"
+        return {
+            "success": True,
+            "message": f"Sorted by {sort_type} ({sort_order})",
+            "accounts": page['accounts'],
+            "offset": offset,
+            "limit": limit,
+            "total": page['total']
+        }
 
-            # Handle sorted lists (criterion 1 or 2)
-            else:
-                sorted_accounts = []
+    result = bank.sort_accounts(criterion, order)
 
-                for line in lines:
-                    line = line.strip()
-                    if not line or any(x in line for x in ['Enter your choice', 'Choose', 'Acct', '====', '?']):
-                        continue
+    if result['success']:
+        lines = result['output'].split('\n')
 
+        # Handle Max/Min Balance (criterion 3 or 4)
+        if criterion == 3 or criterion == 4:
+            for line in lines:
+                line = line.strip()
+                if line and not any(x in line for x in ['Enter your choice', 'Choose', 'Acct', '====', '?']):
                     parts = line.split()
                     if len(parts) >= 4:
                         try:
@@ -692,48 +1151,150 @@ def sort_accounts():
                                 first_name = parts[2]
                                 balance = float(parts[3])
 
-                                sorted_accounts.append({
-                                    'acct_num': acct_num,
-                                    'last_name': last_name,
-                                    'first_name': first_name,
-                                    'balance': balance
-                                })
+                                return {
+                                    "success": True,
+                                    "message": f"{'Maximum' if criterion == 3 else 'Minimum'} balance account found",
+                                    "account": {
+                                        'acct_num': acct_num,
+                                        'last_name': last_name,
+                                        'first_name': first_name,
+                                        'balance': balance
+                                    }
+                                }
                         except (ValueError, IndexError):
                             continue
 
-                if sorted_accounts:
-                    sort_type = "Balance" if criterion == 1 else "Name"
-                    sort_order = "Ascending" if order == 1 else "Descending"
+            return {"success": False, "message": "No valid account found for min/max"}
 
-                    return jsonify({
+        # Handle sorted lists (criterion 1 or 2)
+        else:
+            sorted_accounts = []
+
+            for line in lines:
+                line = line.strip()
+                if not line or any(x in line for x in ['Enter your choice', 'Choose', 'Acct', '====', '?']):
+                    continue
+
+                parts = line.split()
+                if len(parts) >= 4:
+                    try:
+                        acct_num = int(parts[0])
+                        if 1 <= acct_num <= 100:  # Valid account number
+                            last_name = parts[1]
+                            first_name = parts[2]
+                            balance = float(parts[3])
+
+                            sorted_accounts.append({
+                                'acct_num': acct_num,
+                                'last_name': last_name,
+                                'first_name': first_name,
+                                'balance': balance
+                            })
+                    except (ValueError, IndexError):
+                        continue
+
+            if sorted_accounts:
+                sort_type = "Balance" if criterion == 1 else "Name"
+                sort_order = "Ascending" if order == 1 else "Descending"
+
+                return {
+                    "success": True,
+                    "message": f"Sorted by {sort_type} ({sort_order})",
+                    "accounts": sorted_accounts
+                }
+            else:
+                # Fallback: read accounts and sort in Python
+                accounts = bank.read_accounts_from_file()
+                if accounts:
+                    if criterion == 1:  # Sort by balance
+                        sorted_accounts = sorted(accounts, key=lambda x: x['balance'], reverse=(order == 2))
+                    else:  # Sort by name
+                        sorted_accounts = sorted(accounts, key=lambda x: (x['last_name'], x['first_name']), reverse=(order == 2))
+
+                    return {
                         "success": True,
-                        "message": f"Sorted by {sort_type} ({sort_order})",
+                        "message": f"Sorted by {'Balance' if criterion == 1 else 'Name'} ({'Desc' if order == 2 else 'Asc'}) - Python fallback",
                         "accounts": sorted_accounts
-                    })
-                else:
-                    # Fallback: read accounts and sort in Python
-                    accounts = bank.read_accounts_from_file()
-                    if accounts:
-                        if criterion == 1:  # Sort by balance
-                            sorted_accounts = sorted(accounts, key=lambda x: x['balance'], reverse=(order == 2))
-                        else:  # Sort by name
-                            sorted_accounts = sorted(accounts, key=lambda x: (x['last_name'], x['first_name']), reverse=(order == 2))
-
-                        return jsonify({
-                            "success": True,
-                            "message": f"Sorted by {'Balance' if criterion == 1 else 'Name'} ({'Desc' if order == 2 else 'Asc'}) - Python fallback",
-                            "accounts": sorted_accounts
-                        })
-
-                    return jsonify({"success": False, "message": "No accounts to sort"})
+                    }
 
-        else:
-            return jsonify({"success": False, "message": f"Sort failed: {result['error']}"})
+                return {"success": False, "message": "No accounts to sort"}
+
+    else:
+        return {"success": False, "message": f"Sort failed: {result['error']}"}
+
+@app.route('/api/accounts/sort', methods=['POST'])
+def sort_accounts():
+    """Enhanced V6 sorting with all 4 options"""
+    try:
+        data = request.get_json()
+        criterion = int(data['criterion'])  # 1=Balance, 2=Name, 3=Max, 4=Min
+        order = int(data['order'])          # 1=Ascending, 2=Descending
+
+        print(f"=== V6 SORT: Criterion {criterion}, Order {order} ===")
+
+        key = ('sort', criterion, order, data.get('offset'), data.get('limit'))
+        return cached_response(key, lambda: sort_result(criterion, order, data))
 
     except Exception as e:
         print(f"Sort error: {e}")
         return jsonify({"success": False, "message": str(e)})
 
+@app.route('/api/accounts/aggregate', methods=['POST'])
+def aggregate_accounts():
+    """Totals, percentiles and balance histogram with optional filters"""
+    try:
+        data = request.get_json(silent=True) or {}
+        min_balance = data.get('min_balance')
+        max_balance = data.get('max_balance')
+        prefix = str(data.get('prefix') or '*').strip()
+        buckets = int(data.get('buckets', 10))
+
+        if not prefix.isalnum() and prefix != '*':
+            return jsonify({"success": False, "message": "Name prefix must be letters or digits"})
+
+        result = bank.aggregate('*' if min_balance is None else f"{float(min_balance):.2f}",
+                                '*' if max_balance is None else f"{float(max_balance):.2f}",
+                                prefix, buckets)
+        return jsonify(result)
+    except ValueError:
+        return jsonify({"success": False, "message": "Invalid input values"})
+    except Exception as e:
+        return jsonify({"success": False, "message": str(e)})
+
+@app.route('/api/changes', methods=['GET'])
+def stream_changes():
+    """Committed changes as server-sent events from the engine's change feed
+    (I7_FEED). Each event's id is the feed position after it, so a browser
+    that reconnects resumes where it stopped (Last-Event-ID); ?after= gives
+    a position to start after, and the default is "now"."""
+    if not bank.feed:
+        return jsonify({"success": False, "message": f"No change feed configured ({FEED_ENV})"})
+    start = request.headers.get('Last-Event-ID') or request.args.get('after', 'now')
+    if start != 'now' and not all(p.isdigit() for p in start.split(',')):
+        return jsonify({"success": False, "message": "after must be 'now' or comma-separated LSNs"})
+    try:
+        position, changes = bank.subscribe_changes(start)
+    except (OSError, ValueError) as e:
+        return jsonify({"success": False, "message": f"Change feed unavailable: {e}"})
+
+    def events():
+        yield f"event: subscribed\ndata: {json.dumps({'position': position})}\n\n"
+        for change in changes:
+            if change is None:
+                yield ": keep-alive\n\n"  # finds out whether the browser is still there
+            else:
+                yield f"id: {change[0]}\nevent: change\ndata: {json.dumps(change[1])}\n\n"
+
+    return app.response_class(events(), mimetype='text/event-stream', headers={'Cache-Control': 'no-cache'})
+
+@app.route('/api/stats', methods=['GET'])
+def get_stats():
+    """Engine statistics (record cache hits, misses, evictions)"""
+    try:
+        return jsonify(bank.get_stats())
+    except Exception as e:
+        return jsonify({"success": False, "message": str(e), "stats": {}})
+
 @app.route('/api/test', methods=['GET'])
 def test_c_program():
     """Test endpoint to verify V6 C program communication"""